@@ -34,6 +34,9 @@ const OptionInfoRec intel_options[] = {
 	{OPTION_ZAPHOD,		"ZaphodHeads",	OPTV_STRING,	{0},	0},
 	{OPTION_VIRTUAL,	"VirtualHeads",	OPTV_INTEGER,	{0},	0},
 	{OPTION_TEAR_FREE,	"TearFree",	OPTV_BOOLEAN,	{0},	0},
+	{OPTION_TEAR_FREE_BUFFERS, "TearFreeBuffers", OPTV_INTEGER, {0}, 0},
+	{OPTION_VIDEO_BUFFERS,	"VideoBuffers",	OPTV_INTEGER,	{0},	0},
+	{OPTION_VIDEO_BATCH,	"VideoBatch",	OPTV_BOOLEAN,	{0},	0},
 	{OPTION_CRTC_PIXMAPS,	"PerCrtcPixmaps", OPTV_BOOLEAN,	{0},	0},
 #endif
 #ifdef USE_UXA
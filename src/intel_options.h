@@ -38,6 +38,9 @@ enum intel_options {
 	OPTION_ZAPHOD,
 	OPTION_VIRTUAL,
 	OPTION_TEAR_FREE,
+	OPTION_TEAR_FREE_BUFFERS,
+	OPTION_VIDEO_BUFFERS,
+	OPTION_VIDEO_BATCH,
 	OPTION_CRTC_PIXMAPS,
 #endif
 #ifdef USE_UXA
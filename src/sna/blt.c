@@ -32,11 +32,14 @@
 #include "sna.h"
 #include <pixman.h>
 
+#define ROTATE_TILE 32 /* pixels, must be a multiple of 4 */
+
 #if defined(sse2)
 #pragma GCC push_options
 #pragma GCC target("sse2,inline-all-stringops,fpmath=sse")
 #pragma GCC optimize("Ofast")
 #include <xmmintrin.h>
+#include <emmintrin.h>
 
 #if __x86_64__
 #define have_sse2() 1
@@ -631,6 +634,219 @@ memcpy_between_tiled_x__swizzle_0__sse2(const void *src, void *dst, int bpp,
 	}
 }
 
+
+/* Transpose 4x4 blocks of 32bpp pixels, for when walking down a column of
+ * the destination walks along a row of the source (90/270 rotations and
+ * the transposing reflections). Both width and height must be multiples
+ * of 4, the caller finishes the ragged edges.
+ */
+static void
+rotate_blt__transpose_sse2(const uint8_t *src, uint8_t *dst,
+			   int32_t dst_stride,
+			   int width, int height,
+			   int step_i, int step_j)
+{
+	int x0, y0, x, y;
+
+	assert(step_j == 4 || step_j == -4);
+
+	for (y0 = 0; y0 < height; y0 += ROTATE_TILE) {
+		int y1 = MIN(y0 + ROTATE_TILE, height);
+		for (x0 = 0; x0 < width; x0 += ROTATE_TILE) {
+			int x1 = MIN(x0 + ROTATE_TILE, width);
+			for (y = y0; y < y1; y += 4) {
+				const uint8_t *s = src + y * step_j + x0 * step_i;
+				uint8_t *d = dst + y * dst_stride + x0 * 4;
+
+				if (step_j < 0)
+					s -= 12;
+
+				for (x = x0; x < x1; x += 4) {
+					__m128i v0, v1, v2, v3;
+					__m128i t0, t1, t2, t3;
+
+					v0 = xmm_load_128u((const __m128i *)(s + 0 * step_i));
+					v1 = xmm_load_128u((const __m128i *)(s + 1 * step_i));
+					v2 = xmm_load_128u((const __m128i *)(s + 2 * step_i));
+					v3 = xmm_load_128u((const __m128i *)(s + 3 * step_i));
+					if (step_j < 0) {
+						v0 = _mm_shuffle_epi32(v0, 0x1b);
+						v1 = _mm_shuffle_epi32(v1, 0x1b);
+						v2 = _mm_shuffle_epi32(v2, 0x1b);
+						v3 = _mm_shuffle_epi32(v3, 0x1b);
+					}
+
+					t0 = _mm_unpacklo_epi32(v0, v1);
+					t1 = _mm_unpacklo_epi32(v2, v3);
+					t2 = _mm_unpackhi_epi32(v0, v1);
+					t3 = _mm_unpackhi_epi32(v2, v3);
+
+					xmm_save_128u((__m128i *)(d + 0 * dst_stride),
+						      _mm_unpacklo_epi64(t0, t1));
+					xmm_save_128u((__m128i *)(d + 1 * dst_stride),
+						      _mm_unpackhi_epi64(t0, t1));
+					xmm_save_128u((__m128i *)(d + 2 * dst_stride),
+						      _mm_unpacklo_epi64(t2, t3));
+					xmm_save_128u((__m128i *)(d + 3 * dst_stride),
+						      _mm_unpackhi_epi64(t2, t3));
+
+					s += 4 * step_i;
+					d += 16;
+				}
+			}
+		}
+	}
+}
+
+/* Copy 32bpp rows whose source is a (possibly reversed) row of pixels,
+ * i.e. 180 degree rotation and the simple reflections.
+ */
+static void
+rotate_blt__rows_sse2(const uint8_t *src, uint8_t *dst,
+		      int32_t dst_stride,
+		      int width, int height,
+		      int step_i, int step_j)
+{
+	assert(step_i == 4 || step_i == -4);
+
+	while (height--) {
+		const uint8_t *s = src;
+		uint8_t *d = dst;
+		int w = width;
+
+		if (step_i > 0) {
+			memcpy(d, s, 4 * w);
+		} else {
+			while (w >= 4) {
+				__m128i v = xmm_load_128u((const __m128i *)(s - 12));
+				xmm_save_128u((__m128i *)d, _mm_shuffle_epi32(v, 0x1b));
+				s -= 16;
+				d += 16;
+				w -= 4;
+			}
+			while (w--) {
+				*(uint32_t *)d = *(const uint32_t *)s;
+				s -= 4;
+				d += 4;
+			}
+		}
+
+		src += step_j;
+		dst += dst_stride;
+	}
+}
+
+static inline __m128i
+xmm_reverse_epi8(__m128i v)
+{
+	v = _mm_shuffle_epi32(v, 0x4e);
+	v = _mm_shufflelo_epi16(v, 0x1b);
+	v = _mm_shufflehi_epi16(v, 0x1b);
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+/* As rotate_blt__transpose_sse2, but for 16x16 blocks of 8bpp pixels
+ * (the luma and chroma planes of rotated video). Both width and height
+ * must be multiples of 16.
+ */
+static void
+rotate_blt__transpose8_sse2(const uint8_t *src, uint8_t *dst,
+			    int32_t dst_stride,
+			    int width, int height,
+			    int step_i, int step_j)
+{
+	int x0, y0, x, y, k;
+
+	assert(step_j == 1 || step_j == -1);
+
+	for (y0 = 0; y0 < height; y0 += ROTATE_TILE) {
+		int y1 = MIN(y0 + ROTATE_TILE, height);
+		for (x0 = 0; x0 < width; x0 += ROTATE_TILE) {
+			int x1 = MIN(x0 + ROTATE_TILE, width);
+			for (y = y0; y < y1; y += 16) {
+				const uint8_t *s = src + y * step_j + x0 * step_i;
+				uint8_t *d = dst + y * dst_stride + x0;
+
+				if (step_j < 0)
+					s -= 15;
+
+				for (x = x0; x < x1; x += 16) {
+					__m128i v[16], t[16];
+
+					for (k = 0; k < 16; k++) {
+						v[k] = xmm_load_128u((const __m128i *)(s + k * step_i));
+						if (step_j < 0)
+							v[k] = xmm_reverse_epi8(v[k]);
+					}
+
+					for (k = 0; k < 8; k++) {
+						t[k + 0] = _mm_unpacklo_epi8(v[2*k], v[2*k + 1]);
+						t[k + 8] = _mm_unpackhi_epi8(v[2*k], v[2*k + 1]);
+					}
+					for (k = 0; k < 4; k++) {
+						v[k + 0] = _mm_unpacklo_epi16(t[2*k + 0], t[2*k + 1]);
+						v[k + 4] = _mm_unpackhi_epi16(t[2*k + 0], t[2*k + 1]);
+						v[k + 8] = _mm_unpacklo_epi16(t[2*k + 8], t[2*k + 9]);
+						v[k + 12] = _mm_unpackhi_epi16(t[2*k + 8], t[2*k + 9]);
+					}
+					for (k = 0; k < 16; k += 4) {
+						t[k + 0] = _mm_unpacklo_epi32(v[k + 0], v[k + 1]);
+						t[k + 1] = _mm_unpackhi_epi32(v[k + 0], v[k + 1]);
+						t[k + 2] = _mm_unpacklo_epi32(v[k + 2], v[k + 3]);
+						t[k + 3] = _mm_unpackhi_epi32(v[k + 2], v[k + 3]);
+					}
+					for (k = 0; k < 16; k += 4) {
+						xmm_save_128u((__m128i *)(d + (k + 0) * dst_stride),
+							      _mm_unpacklo_epi64(t[k + 0], t[k + 2]));
+						xmm_save_128u((__m128i *)(d + (k + 1) * dst_stride),
+							      _mm_unpackhi_epi64(t[k + 0], t[k + 2]));
+						xmm_save_128u((__m128i *)(d + (k + 2) * dst_stride),
+							      _mm_unpacklo_epi64(t[k + 1], t[k + 3]));
+						xmm_save_128u((__m128i *)(d + (k + 3) * dst_stride),
+							      _mm_unpackhi_epi64(t[k + 1], t[k + 3]));
+					}
+
+					s += 16 * step_i;
+					d += 16;
+				}
+			}
+		}
+	}
+}
+
+/* As rotate_blt__rows_sse2, but for 8bpp pixels. */
+static void
+rotate_blt__rows8_sse2(const uint8_t *src, uint8_t *dst,
+		       int32_t dst_stride,
+		       int width, int height,
+		       int step_i, int step_j)
+{
+	assert(step_i == 1 || step_i == -1);
+
+	while (height--) {
+		const uint8_t *s = src;
+		uint8_t *d = dst;
+		int w = width;
+
+		if (step_i > 0) {
+			memcpy(d, s, w);
+		} else {
+			while (w >= 16) {
+				__m128i v = xmm_load_128u((const __m128i *)(s - 15));
+				xmm_save_128u((__m128i *)d, xmm_reverse_epi8(v));
+				s -= 16;
+				d += 16;
+				w -= 16;
+			}
+			while (w--)
+				*d++ = *s--;
+		}
+
+		src += step_j;
+		dst += dst_stride;
+	}
+}
+
 #pragma GCC push_options
 #endif
 
@@ -1789,3 +2005,143 @@ next:
 		}
 	}
 }
+
+#define ROTATE_BLT(name, type)						\
+static void								\
+name(const uint8_t *src, uint8_t *dst, int32_t dst_stride,		\
+     int width, int height, int step_i, int step_j)			\
+{									\
+	int x0, y0, x, y;						\
+									\
+	for (y0 = 0; y0 < height; y0 += ROTATE_TILE) {			\
+		int y1 = MIN(y0 + ROTATE_TILE, height);			\
+		for (x0 = 0; x0 < width; x0 += ROTATE_TILE) {		\
+			int x1 = MIN(x0 + ROTATE_TILE, width);		\
+			for (y = y0; y < y1; y++) {			\
+				const uint8_t *s = src + y * step_j + x0 * step_i; \
+				type *d = (type *)(dst + y * dst_stride) + x0; \
+				for (x = x0; x < x1; x++) {		\
+					*d++ = *(const type *)s;	\
+					s += step_i;			\
+				}					\
+			}						\
+		}							\
+	}								\
+}
+ROTATE_BLT(rotate_blt__8, uint8_t)
+ROTATE_BLT(rotate_blt__16, uint16_t)
+ROTATE_BLT(rotate_blt__32, uint32_t)
+#undef ROTATE_BLT
+
+/* Copy a box applying one of the 8 axis-aligned orientations: destination
+ * pixel (dst_x + i, dst_y + j) is read from source pixel
+ * (src_x + i*xx + j*xy, src_y + i*yx + j*yy), where the coefficients are
+ * 0 or +-1 and form a rotation or reflection. The walk is blocked into
+ * ROTATE_TILE squares so that both surfaces stay in cache.
+ */
+fast void
+rotate_blt(const void *src, void *dst, int bpp,
+	   int32_t src_stride, int32_t dst_stride,
+	   int16_t src_x, int16_t src_y,
+	   int16_t dst_x, int16_t dst_y,
+	   uint16_t width, uint16_t height,
+	   int xx, int xy, int yx, int yy)
+{
+	const int cpp = bpp / 8;
+	const int step_i = xx * cpp + yx * src_stride;
+	const int step_j = xy * cpp + yy * src_stride;
+	const uint8_t *src_bytes;
+	uint8_t *dst_bytes;
+
+	assert(xx * yy - xy * yx == 1 || xx * yy - xy * yx == -1);
+	assert(width && height);
+
+	src_bytes = (const uint8_t *)src + src_y * src_stride + src_x * cpp;
+	dst_bytes = (uint8_t *)dst + dst_y * dst_stride + dst_x * cpp;
+
+	DBG(("%s: (%d, %d) -> (%d, %d) x (%d, %d), bpp=%d, matrix=[%d %d; %d %d]\n",
+	     __FUNCTION__, src_x, src_y, dst_x, dst_y, width, height, bpp,
+	     xx, xy, yx, yy));
+
+	switch (bpp) {
+	case 8:
+#if defined(sse2)
+		if (have_sse2()) {
+			if (xx) {
+				rotate_blt__rows8_sse2(src_bytes, dst_bytes,
+						       dst_stride,
+						       width, height,
+						       step_i, step_j);
+				break;
+			}
+
+			if (width >= 16 && height >= 16) {
+				int w = width & ~15, h = height & ~15;
+
+				rotate_blt__transpose8_sse2(src_bytes, dst_bytes,
+							    dst_stride,
+							    w, h, step_i, step_j);
+				if (w < width)
+					rotate_blt__8(src_bytes + w * step_i,
+						      dst_bytes + w,
+						      dst_stride,
+						      width - w, h,
+						      step_i, step_j);
+				if (h < height)
+					rotate_blt__8(src_bytes + h * step_j,
+						      dst_bytes + h * dst_stride,
+						      dst_stride,
+						      width, height - h,
+						      step_i, step_j);
+				break;
+			}
+		}
+#endif
+		rotate_blt__8(src_bytes, dst_bytes, dst_stride,
+			      width, height, step_i, step_j);
+		break;
+	case 16:
+		rotate_blt__16(src_bytes, dst_bytes, dst_stride,
+			       width, height, step_i, step_j);
+		break;
+	case 32:
+#if defined(sse2)
+		if (have_sse2()) {
+			if (xx) {
+				rotate_blt__rows_sse2(src_bytes, dst_bytes,
+						      dst_stride,
+						      width, height,
+						      step_i, step_j);
+				break;
+			}
+
+			if (width >= 4 && height >= 4) {
+				int w = width & ~3, h = height & ~3;
+
+				rotate_blt__transpose_sse2(src_bytes, dst_bytes,
+							   dst_stride,
+							   w, h, step_i, step_j);
+				if (w < width)
+					rotate_blt__32(src_bytes + w * step_i,
+						       dst_bytes + w * 4,
+						       dst_stride,
+						       width - w, h,
+						       step_i, step_j);
+				if (h < height)
+					rotate_blt__32(src_bytes + h * step_j,
+						       dst_bytes + h * dst_stride,
+						       dst_stride,
+						       width, height - h,
+						       step_i, step_j);
+				break;
+			}
+		}
+#endif
+		rotate_blt__32(src_bytes, dst_bytes, dst_stride,
+			       width, height, step_i, step_j);
+		break;
+	default:
+		assert(0);
+		break;
+	}
+}
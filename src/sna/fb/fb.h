@@ -286,6 +286,13 @@ typedef struct {
 extern DevPrivateKeyRec sna_gc_key;
 extern DevPrivateKeyRec sna_window_key;
 
+/* Provided by the SNA thread pool; runs func() over horizontal bands of
+ * [0, height) and returns false if the caller should run it inline.
+ */
+extern bool sna_threads_bands(int width, int height, int threshold,
+			      void (*func)(void *arg, int y, int height),
+			      void *arg);
+
 static inline FbGCPrivate *fb_gc(GCPtr gc)
 {
 	return (FbGCPrivate *)__get_private(gc, sna_gc_key);
@@ -561,6 +568,9 @@ fbTile(FbBits *dst, FbStride dstStride, int dstX, int width, int height,
        int alu, FbBits pm, int bpp,
        int xRot, int yRot);
 
+extern void
+fbReplicateRow(uint8_t *d, const uint8_t *t, int period, int phase, int n);
+
 extern FbBits fbReplicatePixel(Pixel p, int bpp);
 
 #endif  /* FB_H */
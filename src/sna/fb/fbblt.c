@@ -263,12 +263,12 @@ fbBlt__rop(FbBits *srcLine, FbStride srcStride, int srcX,
 	}
 }
 
-void
-fbBlt(FbBits *srcLine, FbStride srcStride, int srcX,
-      FbBits *dstLine, FbStride dstStride, int dstX,
-      int width, int height,
-      int alu, FbBits pm, int bpp,
-      Bool reverse, Bool upsidedown)
+static void
+__fbBlt(FbBits *srcLine, FbStride srcStride, int srcX,
+	FbBits *dstLine, FbStride dstStride, int dstX,
+	int width, int height,
+	int alu, FbBits pm, int bpp,
+	Bool reverse, Bool upsidedown)
 {
 	DBG(("%s %dx%d, alu=%d, pm=%x, bpp=%d (reverse=%d, upsidedown=%d)\n",
 	     __FUNCTION__, width, height, alu, pm, bpp, reverse, upsidedown));
@@ -319,3 +319,77 @@ fbBlt(FbBits *srcLine, FbStride srcStride, int srcX,
 		   alu, pm, bpp,
 		   reverse, upsidedown);
 }
+
+struct blt_bands {
+	FbBits *src, *dst;
+	FbStride srcStride, dstStride;
+	int srcX, dstX;
+	int width;
+	int alu;
+	FbBits pm;
+	int bpp;
+	Bool reverse;
+};
+
+static void fbBltBand(void *arg, int y, int height)
+{
+	struct blt_bands *b = arg;
+
+	__fbBlt(b->src + y * b->srcStride, b->srcStride, b->srcX,
+		b->dst + y * b->dstStride, b->dstStride, b->dstX,
+		b->width, height,
+		b->alu, b->pm, b->bpp,
+		b->reverse, FALSE);
+}
+
+static bool
+fbBltOverlaps(FbBits *src, FbStride srcStride, int srcX,
+	      FbBits *dst, FbStride dstStride, int dstX,
+	      int width, int height)
+{
+	FbBits *src_end, *dst_end;
+
+	src += srcX >> FB_SHIFT;
+	dst += dstX >> FB_SHIFT;
+	src_end = src + (height - 1) * srcStride + ((srcX & FB_MASK) + width + FB_MASK) / FB_UNIT;
+	dst_end = dst + (height - 1) * dstStride + ((dstX & FB_MASK) + width + FB_MASK) / FB_UNIT;
+
+	return src < dst_end && dst < src_end;
+}
+
+void
+fbBlt(FbBits *srcLine, FbStride srcStride, int srcX,
+      FbBits *dstLine, FbStride dstStride, int dstX,
+      int width, int height,
+      int alu, FbBits pm, int bpp,
+      Bool reverse, Bool upsidedown)
+{
+	/* Only split the rows between threads if they are independent */
+	if (srcStride >= 0 && dstStride > 0 &&
+	    !fbBltOverlaps(srcLine, srcStride, srcX,
+			   dstLine, dstStride, dstX,
+			   width, height)) {
+		struct blt_bands b;
+
+		b.src = srcLine;
+		b.srcStride = srcStride;
+		b.srcX = srcX;
+		b.dst = dstLine;
+		b.dstStride = dstStride;
+		b.dstX = dstX;
+		b.width = width;
+		b.alu = alu;
+		b.pm = pm;
+		b.bpp = bpp;
+		b.reverse = reverse;
+
+		if (sna_threads_bands(width / bpp, height, 32, fbBltBand, &b))
+			return;
+	}
+
+	__fbBlt(srcLine, srcStride, srcX,
+		dstLine, dstStride, dstX,
+		width, height,
+		alu, pm, bpp,
+		reverse, upsidedown);
+}
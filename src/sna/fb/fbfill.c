@@ -60,8 +60,8 @@ fbSolid(FbBits * dst,
 	}
 }
 
-void
-fbFill(DrawablePtr drawable, GCPtr gc, int x, int y, int width, int height)
+static void
+__fbFill(DrawablePtr drawable, GCPtr gc, int x, int y, int width, int height)
 {
 	FbBits *dst;
 	FbStride dstStride;
@@ -156,6 +156,38 @@ fbFill(DrawablePtr drawable, GCPtr gc, int x, int y, int width, int height)
 	}
 }
 
+struct fill_bands {
+	DrawablePtr drawable;
+	GCPtr gc;
+	int x, y, width;
+};
+
+static void fbFillBand(void *arg, int y, int height)
+{
+	struct fill_bands *f = arg;
+
+	__fbFill(f->drawable, f->gc, f->x, f->y + y, f->width, height);
+}
+
+void
+fbFill(DrawablePtr drawable, GCPtr gc, int x, int y, int width, int height)
+{
+	struct fill_bands f;
+
+	/* Each band recomputes its pattern origin from its own y, so solid,
+	 * tiled and stippled fills can all be split by rows.
+	 */
+	f.drawable = drawable;
+	f.gc = gc;
+	f.x = x;
+	f.y = y;
+	f.width = width;
+	if (sna_threads_bands(width, height, 32, fbFillBand, &f))
+		return;
+
+	__fbFill(drawable, gc, x, y, width, height);
+}
+
 static void
 _fbSolidBox(DrawablePtr drawable, GCPtr gc, const BoxRec *b, void *_data)
 {
@@ -21,8 +21,13 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <string.h>
 #include "fb.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /*
  * This is a slight abuse of the preprocessor to generate repetitive
  * code, the idea is to generate code for each case of a copy-mode
@@ -201,6 +206,147 @@ fbOddStipple(FbBits *dst, FbStride dstStride, int dstX, int dstBpp,
 	}
 }
 
+#define STIPPLE_MAX 256
+
+/*
+ * Expand n pixels, given a byte mask (0 or 0xff) per pixel, with
+ * dst = (dst & (mask ? fgand : bgand)) ^ (mask ? fgxor : bgxor)
+ */
+static void
+fbStippleSpan(uint8_t *d, const uint8_t *m, int n, int bpp,
+	      FbBits fgand, FbBits fgxor, FbBits bgand, FbBits bgxor)
+{
+	int cpp = bpp >> 3;
+
+#if defined(__SSE2__)
+	{
+		__m128i FA = _mm_set1_epi32(fgand), BA = _mm_set1_epi32(bgand);
+		__m128i FX = _mm_set1_epi32(fgxor), BX = _mm_set1_epi32(bgxor);
+
+		while (n >= 16) {
+			__m128i mask = _mm_loadu_si128((const __m128i *)m);
+			__m128i lane[4];
+			int i, count;
+
+			switch (bpp) {
+			case 8:
+				lane[0] = mask;
+				count = 1;
+				break;
+			case 16:
+				lane[0] = _mm_unpacklo_epi8(mask, mask);
+				lane[1] = _mm_unpackhi_epi8(mask, mask);
+				count = 2;
+				break;
+			default: {
+				__m128i lo = _mm_unpacklo_epi8(mask, mask);
+				__m128i hi = _mm_unpackhi_epi8(mask, mask);
+				lane[0] = _mm_unpacklo_epi16(lo, lo);
+				lane[1] = _mm_unpackhi_epi16(lo, lo);
+				lane[2] = _mm_unpacklo_epi16(hi, hi);
+				lane[3] = _mm_unpackhi_epi16(hi, hi);
+				count = 4;
+				break;
+			}
+			}
+
+			for (i = 0; i < count; i++) {
+				__m128i v = _mm_loadu_si128((const __m128i *)d);
+				__m128i and, xor;
+
+				and = _mm_or_si128(_mm_and_si128(lane[i], FA),
+						   _mm_andnot_si128(lane[i], BA));
+				xor = _mm_or_si128(_mm_and_si128(lane[i], FX),
+						   _mm_andnot_si128(lane[i], BX));
+				v = _mm_xor_si128(_mm_and_si128(v, and), xor);
+				_mm_storeu_si128((__m128i *)d, v);
+				d += 16;
+			}
+
+			m += 16;
+			n -= 16;
+		}
+	}
+#endif
+
+	while (n--) {
+		FbBits and, xor, v = 0;
+
+		if (*m++) {
+			and = fgand;
+			xor = fgxor;
+		} else {
+			and = bgand;
+			xor = bgxor;
+		}
+
+		memcpy(&v, d, cpp);
+		v = (v & and) ^ xor;
+		memcpy(d, &v, cpp);
+		d += cpp;
+	}
+}
+
+/*
+ * Odd stipples at 8, 16 and 32bpp. Unpack each stipple row into a
+ * byte mask once, replicate it across the span and then expand it to
+ * the foreground/background rops 16 pixels at a time, rather than
+ * calling fbBltOne() for every repeat of the stipple.
+ */
+static Bool
+fbOddStippleBytes(FbBits *dst, FbStride dstStride, int dstX, int dstBpp,
+		  int width, int height,
+		  FbStip *stip, FbStride stipStride,
+		  int stipWidth, int stipHeight,
+		  FbBits fgand, FbBits fgxor, FbBits bgand, FbBits bgxor,
+		  int xRot, int yRot)
+{
+	uint8_t row[STIPPLE_MAX], mask[STIPPLE_MAX];
+	int stipX, stipY, cpp;
+
+	if (dstBpp != 8 && dstBpp != 16 && dstBpp != 32)
+		return FALSE;
+
+	if (stipWidth > STIPPLE_MAX)
+		return FALSE;
+
+	DBG(("%s stipple=%dx%d, size=%dx%d\n", __FUNCTION__,
+	     stipWidth, stipHeight, width / dstBpp, height));
+
+	cpp = dstBpp >> 3;
+	width /= dstBpp;
+
+	modulus(-yRot, stipHeight, stipY);
+	modulus(dstX / dstBpp - xRot, stipWidth, stipX);
+
+	while (height--) {
+		const FbStip *s = stip + stipY * stipStride;
+		uint8_t *d = (uint8_t *)dst + (dstX >> 3);
+		int x;
+
+		for (x = 0; x < stipWidth; x++)
+			row[x] = -((s[x >> FB_STIP_SHIFT] >> (x & FB_STIP_MASK)) & 1);
+
+		for (x = 0; x < width; ) {
+			int n = width - x;
+			if (n > STIPPLE_MAX)
+				n = STIPPLE_MAX;
+
+			fbReplicateRow(mask, row, stipWidth,
+				       (stipX + x) % stipWidth, n);
+			fbStippleSpan(d + x * cpp, mask, n, dstBpp,
+				      fgand, fgxor, bgand, bgxor);
+			x += n;
+		}
+
+		if (++stipY == stipHeight)
+			stipY = 0;
+		dst += dstStride;
+	}
+
+	return TRUE;
+}
+
 void
 fbStipple(FbBits *dst, FbStride dstStride, int dstX, int dstBpp,
           int width, int height,
@@ -216,7 +362,9 @@ fbStipple(FbBits *dst, FbStride dstStride, int dstX, int dstBpp,
 		fbEvenStipple(dst, dstStride, dstX, dstBpp, width, height,
 			      stip, stipStride, stipHeight,
 			      fgand, fgxor, bgand, bgxor, xRot, yRot);
-	else
+	else if (!fbOddStippleBytes(dst, dstStride, dstX, dstBpp, width, height,
+				    stip, stipStride, stipWidth, stipHeight,
+				    fgand, fgxor, bgand, bgxor, xRot, yRot))
 		fbOddStipple(dst, dstStride, dstX, dstBpp, width, height,
 			     stip, stipStride, stipWidth, stipHeight,
 			     fgand, fgxor, bgand, bgxor, xRot, yRot);
@@ -21,8 +21,13 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <string.h>
 #include "fb.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /*
  * Accelerated tile fill -- tile width is a power of two not greater
  * than FB_UNIT
@@ -130,6 +135,167 @@ fbOddTile(FbBits *dst, FbStride dstStride, int dstX,
 	}
 }
 
+/*
+ * Fill n bytes of d with the pattern of the given period (in bytes),
+ * starting phase bytes into t: copy the partial period, one whole period
+ * and then keep doubling what we have written so far.
+ */
+void
+fbReplicateRow(uint8_t *d, const uint8_t *t, int period, int phase, int n)
+{
+	int start, filled, len;
+
+	len = period - phase;
+	if (len > n)
+		len = n;
+	memcpy(d, t + phase, len);
+	if (len == n)
+		return;
+
+	start = len;
+	len = period;
+	if (start + len > n)
+		len = n - start;
+	memcpy(d + start, t, len);
+
+	filled = start + len;
+	while (filled < n) {
+		len = filled - start;
+		if (filled + len > n)
+			len = n - filled;
+		memcpy(d + filled, d + start, len);
+		filled += len;
+	}
+}
+
+/*
+ * dst = (dst & fbAnd(alu, src, pm)) ^ fbXor(alu, src, pm), bytewise
+ */
+static void
+fbTileSpan(uint8_t *d, const uint8_t *s, int n, int alu, FbBits pm)
+{
+	FbBits a1 = fbFillFromBit(alu ^ (alu >> 1), FbBits);
+	FbBits a2 = fbFillFromBit((alu >> 2) ^ (alu >> 3), FbBits);
+	FbBits x1 = fbFillFromBit(alu >> 1, FbBits);
+	FbBits x2 = fbFillFromBit(alu >> 3, FbBits);
+
+#if defined(__SSE2__)
+	{
+		__m128i A1 = _mm_set1_epi32(a1), A2 = _mm_set1_epi32(a2);
+		__m128i X1 = _mm_set1_epi32(x1), X2 = _mm_set1_epi32(x2);
+		__m128i PM = _mm_set1_epi32(pm);
+
+		while (n >= 16) {
+			__m128i src = _mm_loadu_si128((const __m128i *)s);
+			__m128i v = _mm_loadu_si128((const __m128i *)d);
+			__m128i and, xor;
+
+			and = _mm_or_si128(_mm_and_si128(src, A1),
+					   _mm_andnot_si128(src, A2));
+			and = _mm_or_si128(and, _mm_andnot_si128(PM, _mm_set1_epi32(-1)));
+			xor = _mm_or_si128(_mm_and_si128(src, X1),
+					   _mm_andnot_si128(src, X2));
+			xor = _mm_and_si128(xor, PM);
+
+			v = _mm_xor_si128(_mm_and_si128(v, and), xor);
+			_mm_storeu_si128((__m128i *)d, v);
+
+			d += 16;
+			s += 16;
+			n -= 16;
+		}
+	}
+#endif
+
+	while (n >= 4) {
+		FbBits src, v;
+
+		memcpy(&src, s, 4);
+		memcpy(&v, d, 4);
+		v = (v & fbAnd(alu, src, pm)) ^ fbXor(alu, src, pm);
+		memcpy(d, &v, 4);
+
+		d += 4;
+		s += 4;
+		n -= 4;
+	}
+
+	/* the tail starts on a pixel boundary, so pm lines up bytewise */
+	while (n--) {
+		uint8_t src = *s++;
+		uint8_t and = ((src & a1) | (~src & a2)) | ~pm;
+		uint8_t xor = ((src & x1) | (~src & x2)) & pm;
+
+		*d = (*d & and) ^ xor;
+		d++;
+		pm >>= 8;
+	}
+}
+
+#define TILE_SPAN 1024
+
+/*
+ * Odd tiles at 8, 16 and 32bpp. Instead of an fbBlt() per tile across
+ * each band, build each scanline by replicating the tile row (directly
+ * into the destination for plain copies) and apply the rop 16 bytes at
+ * a time.
+ */
+static Bool
+fbOddTileBytes(FbBits *dst, FbStride dstStride, int dstX,
+	       int width, int height,
+	       FbBits *tile, FbStride tileStride,
+	       int tileWidth, int tileHeight,
+	       int alu, FbBits pm, int bpp,
+	       int xRot, int yRot)
+{
+	uint8_t buf[TILE_SPAN];
+	int tileX, tileY;
+
+	if (bpp != 8 && bpp != 16 && bpp != 32)
+		return FALSE;
+
+	if ((dstX | width | tileWidth | xRot) & 7)
+		return FALSE;
+
+	DBG(("%s tile=%dx%d, size=%dx%d, alu=%d, pm=%x\n", __FUNCTION__,
+	     tileWidth / bpp, tileHeight, width / bpp, height, alu, pm));
+
+	modulus(-yRot, tileHeight, tileY);
+	modulus(dstX - xRot, tileWidth, tileX);
+
+	tileWidth >>= 3;
+	tileX >>= 3;
+	width >>= 3;
+
+	while (height--) {
+		uint8_t *d = (uint8_t *)dst + (dstX >> 3);
+		const uint8_t *t = (const uint8_t *)(tile + tileY * tileStride);
+
+		if (alu == GXcopy && pm == FB_ALLONES) {
+			fbReplicateRow(d, t, tileWidth, tileX, width);
+		} else {
+			int x = 0;
+
+			while (x < width) {
+				int n = width - x;
+				if (n > TILE_SPAN)
+					n = TILE_SPAN;
+
+				fbReplicateRow(buf, t, tileWidth,
+					       (tileX + x) % tileWidth, n);
+				fbTileSpan(d + x, buf, n, alu, pm);
+				x += n;
+			}
+		}
+
+		if (++tileY == tileHeight)
+			tileY = 0;
+		dst += dstStride;
+	}
+
+	return TRUE;
+}
+
 void
 fbTile(FbBits *dst, FbStride dstStride, int dstX,
        int width, int height,
@@ -144,7 +310,9 @@ fbTile(FbBits *dst, FbStride dstStride, int dstX,
 	if (FbEvenTile(tileWidth))
 		fbEvenTile(dst, dstStride, dstX, width, height,
 			   tile, tileStride, tileHeight, alu, pm, xRot, yRot);
-	else
+	else if (!fbOddTileBytes(dst, dstStride, dstX, width, height,
+				 tile, tileStride, tileWidth, tileHeight,
+				 alu, pm, bpp, xRot, yRot))
 		fbOddTile(dst, dstStride, dstX, width, height,
 			  tile, tileStride, tileWidth, tileHeight,
 			  alu, pm, bpp, xRot, yRot);
@@ -34,6 +34,7 @@
 #define fbStipple sfbStipple
 #define fbTile sfbTile
 #define fbReplicatePixel sfbReplicatePixel
+#define fbReplicateRow sfbReplicateRow
 
 #define fbComposite sfbComposite
 #define image_from_pict simage_from_pict
@@ -1839,6 +1839,8 @@ static unsigned select_video_kernel(const struct sna_video_frame *frame)
 	case FOURCC_YV12:
 	case FOURCC_I420:
 	case FOURCC_XVMC:
+	case FOURCC_NV12:
+	case FOURCC_P010:
 		return GEN7_WM_KERNEL_VIDEO_PLANAR;
 
 	case FOURCC_RGB888:
@@ -105,6 +105,8 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 struct sna_cursor;
 struct sna_crtc;
+struct sna_traps;
+struct sna_traps_cache;
 
 struct sna_client {
 	struct list events;
@@ -135,6 +137,9 @@ struct sna_pixmap {
 	bool (*move_to_gpu)(struct sna *, struct sna_pixmap *, unsigned);
 	void *move_to_gpu_data;
 
+	struct sna_traps *traps;
+	unsigned int deferred_video;
+
 	struct list flush_list;
 	struct list cow_list;
 
@@ -245,6 +250,9 @@ enum {
 	NUM_TIMERS
 };
 
+/* Upper clamp for the TearFreeBuffers option, see sna_driver.c */
+#define SHADOW_MAX_BUFFERS 4
+
 struct sna {
 	struct kgem kgem;
 
@@ -297,6 +305,8 @@ struct sna {
 
 	struct list flush_pixmaps;
 	struct list active_pixmaps;
+	struct list deferred_traps;
+	struct sna_traps_cache *traps_cache;
 
 	PixmapPtr front;
 	PixmapPtr freed_pixmap;
@@ -304,6 +314,7 @@ struct sna {
 	struct sna_mode {
 		DamagePtr shadow_damage;
 		struct kgem_bo *shadow;
+		unsigned shadow_buffers;
 		unsigned front_active;
 		unsigned shadow_active;
 		unsigned rr_active;
@@ -317,6 +328,16 @@ struct sna {
 		int shadow_nevent;
 		int shadow_size;
 
+		struct {
+			int fd;
+			bool armed;
+			bool flip;
+			uint64_t target;
+			int frame;
+			int cost;
+			int margin;
+		} latch;
+
 		int max_crtc_width, max_crtc_height;
 		RegionRec shadow_region;
 		RegionRec shadow_cancel;
@@ -345,6 +366,7 @@ struct sna {
 		CursorPtr ref;
 
 		unsigned serial;
+		uint64_t hash;
 		uint32_t fg, bg;
 		int size;
 
@@ -390,6 +412,13 @@ struct sna {
 #if HAVE_PRESENT
 		struct list vblank_queue;
 		uint64_t unflip;
+		struct {
+			struct kgem_bo *bo;
+			RRCrtcPtr crtc;
+			uint64_t event_id;
+			uint64_t target_msc;
+			bool sync;
+		} queued;
 		void *freed_info;
 #endif
 	} present;
@@ -397,6 +426,9 @@ struct sna {
 	struct sna_xv {
 		XvAdaptorPtr adaptors;
 		int num_adaptors;
+		int num_buffers;
+		struct list pending;
+		bool batch;
 	} xv;
 
 	EntityInfoPtr pEnt;
@@ -468,6 +500,12 @@ extern void sna_mode_enable(struct sna *sna);
 extern void sna_mode_reset(struct sna *sna);
 extern int sna_mode_wakeup(struct sna *sna);
 extern void sna_mode_redisplay(struct sna *sna);
+extern void _sna_mode_latch_wakeup(struct sna *sna);
+static inline void sna_mode_latch_wakeup(struct sna *sna, void *read_mask)
+{
+	if (sna->mode.latch.fd >= 0 && FD_ISSET(sna->mode.latch.fd, (fd_set*)read_mask))
+		_sna_mode_latch_wakeup(sna);
+}
 extern void sna_shadow_set_crtc(struct sna *sna, xf86CrtcPtr crtc, struct kgem_bo *bo);
 extern void sna_shadow_steal_crtcs(struct sna *sna, struct list *list);
 extern void sna_shadow_unsteal_crtcs(struct sna *sna, struct list *list);
@@ -620,12 +658,14 @@ void sna_present_update(struct sna *sna);
 void sna_present_close(struct sna *sna, ScreenPtr pScreen);
 void sna_present_vblank_handler(struct drm_event_vblank *event);
 void sna_present_cancel_flip(struct sna *sna);
+void sna_present_flip_idle(struct sna *sna);
 #else
 static inline bool sna_present_open(struct sna *sna, ScreenPtr pScreen) { return false; }
 static inline void sna_present_update(struct sna *sna) { }
 static inline void sna_present_close(struct sna *sna, ScreenPtr pScreen) { }
 static inline void sna_present_vblank_handler(struct drm_event_vblank *event) { }
 static inline void sna_present_cancel_flip(struct sna *sna) { }
+static inline void sna_present_flip_idle(struct sna *sna) { }
 #endif
 
 extern unsigned sna_crtc_count_sprites(xf86CrtcPtr crtc);
@@ -1131,6 +1171,31 @@ void sna_composite_trapezoids(CARD8 op,
 			      INT16 xSrc, INT16 ySrc,
 			      int ntrap, xTrapezoid *traps);
 void sna_add_traps(PicturePtr picture, INT16 x, INT16 y, int n, xTrap *t);
+void __sna_pixmap_flush_traps(struct sna_pixmap *priv);
+void sna_traps_flush(struct sna *sna);
+void sna_traps_cache_fini(struct sna *sna);
+
+void sna_video_flush(struct sna *sna);
+
+static inline void sna_pixmap_flush_deferred(struct sna_pixmap *priv)
+{
+	if (priv == NULL)
+		return;
+
+	/* Rasterise any AddTraps batch queued against this pixmap */
+	if (priv->traps)
+		__sna_pixmap_flush_traps(priv);
+
+	/* and composite any Xv frames waiting for the block handler */
+	if (priv->deferred_video)
+		sna_video_flush(to_sna_from_pixmap(priv->pixmap));
+}
+
+static inline void sna_picture_flush_deferred(PicturePtr picture)
+{
+	if (picture && picture->pDrawable)
+		sna_pixmap_flush_deferred(sna_pixmap_from_drawable(picture->pDrawable));
+}
 
 void sna_composite_triangles(CARD8 op,
 			     PicturePtr src,
@@ -1226,6 +1291,14 @@ affine_blt(const void *src, void *dst, int bpp,
 	   int32_t dst_stride,
 	   const struct pixman_f_transform *t);
 
+void
+rotate_blt(const void *src, void *dst, int bpp,
+	   int32_t src_stride, int32_t dst_stride,
+	   int16_t src_x, int16_t src_y,
+	   int16_t dst_x, int16_t dst_y,
+	   uint16_t width, uint16_t height,
+	   int xx, int xy, int yx, int yy);
+
 void
 memmove_box(const void *src, void *dst,
 	    int bpp, int32_t stride,
@@ -1324,6 +1397,7 @@ void sna_acpi_fini(struct sna *sna);
 void sna_threads_init(void);
 int sna_use_threads (int width, int height, int threshold);
 void sna_threads_run(int id, void (*func)(void *arg), void *arg);
+/* sna_threads_bands() is declared by fb/fb.h, included above */
 void sna_threads_trap(int sig);
 void sna_threads_wait(void);
 void sna_threads_kill(void);
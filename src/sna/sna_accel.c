@@ -77,6 +77,9 @@
 #define USE_CPU_BO 1
 #define USE_USERPTR_UPLOADS 1
 #define USE_USERPTR_DOWNLOADS 1
+#define USE_STAGED_DOWNLOADS 1
+#define USE_GLYPH_ATLAS 1
+#define USE_FILL_BATCH 1
 #define USE_COW 1
 #define UNDO 1
 
@@ -225,6 +228,14 @@ static const GCFuncs sna_gc_funcs__cpu;
 static void sna_shm_watch_flush(struct sna *sna, int enable);
 static void
 sna_poly_fill_rect__gpu(DrawablePtr draw, GCPtr gc, int n, xRectangle *rect);
+static bool
+sna_poly_fill_rect_blt(DrawablePtr drawable,
+		       struct kgem_bo *bo,
+		       struct sna_damage **damage,
+		       GCPtr gc, uint32_t pixel,
+		       int n, const xRectangle *rect,
+		       const BoxRec *extents,
+		       unsigned flags);
 
 static inline void region_set(RegionRec *r, const BoxRec *b)
 {
@@ -2170,6 +2181,8 @@ _sna_pixmap_move_to_cpu(PixmapPtr pixmap, unsigned int flags)
 		return true;
 	}
 
+	sna_pixmap_flush_deferred(priv);
+
 	DBG(("%s: gpu_bo=%d, gpu_damage=%p, cpu_damage=%p, is-clear?=%d\n",
 	     __FUNCTION__,
 	     priv->gpu_bo ? priv->gpu_bo->handle : 0,
@@ -2647,6 +2660,7 @@ sna_drawable_move_region_to_cpu(DrawablePtr drawable,
 		return true;
 	}
 
+	sna_pixmap_flush_deferred(priv);
 	assert(priv->gpu_damage == NULL || priv->gpu_bo);
 
 	if (kgem_bo_discard_cache(priv->gpu_bo, flags & MOVE_WRITE)) {
@@ -3364,6 +3378,8 @@ sna_pixmap_move_area_to_gpu(PixmapPtr pixmap, const BoxRec *box, unsigned int fl
 	if (priv == NULL)
 		return NULL;
 
+	sna_pixmap_flush_deferred(priv);
+
 	assert(box->x2 > box->x1 && box->y2 > box->y1);
 	assert_pixmap_damage(pixmap);
 	assert_pixmap_contains_box(pixmap, box);
@@ -3632,6 +3648,8 @@ sna_drawable_use_bo(DrawablePtr drawable, unsigned flags, const BoxRec *box,
 		return NULL;
 	}
 
+	sna_pixmap_flush_deferred(priv);
+
 	if (priv->cow) {
 		unsigned cow = MOVE_WRITE | MOVE_READ | __MOVE_FORCE;
 		assert(cow);
@@ -4218,6 +4236,7 @@ sna_pixmap_move_to_gpu(PixmapPtr pixmap, unsigned flags)
 	if (priv == NULL)
 		return NULL;
 
+	sna_pixmap_flush_deferred(priv);
 	assert_pixmap_damage(pixmap);
 
 	if (priv->move_to_gpu &&
@@ -7271,6 +7290,9 @@ sna_copy_area(DrawablePtr src, DrawablePtr dst, GCPtr gc,
 	     dst_x, dst_y, dst->x, dst->y,
 	     gc->alu, gc->planemask, gc->depth));
 
+	sna_pixmap_flush_deferred(sna_pixmap_from_drawable(src));
+	sna_pixmap_flush_deferred(sna_pixmap_from_drawable(dst));
+
 	if (FORCE_FALLBACK || !ACCEL_COPY_AREA || wedged(sna) ||
 	    !PM_IS_SOLID(dst, gc->planemask) || gc->depth < 8) {
 		DBG(("%s: fallback copy\n", __FUNCTION__));
@@ -7307,6 +7329,16 @@ __find_clip_box_for_y(const BoxRec *begin, const BoxRec *end, int16_t y)
 		return end;
 }
 
+/* Solid spans and rectangles emitted by the mi wide line/arc code,
+ * accumulated across its many small FillSpans/PolyFillRect calls and
+ * submitted as a single clipped fill per colour.
+ */
+struct sna_fill_batch {
+	uint32_t color;
+	int num;
+	xRectangle rect[512];
+};
+
 struct sna_fill_spans {
 	struct sna *sna;
 	PixmapPtr pixmap;
@@ -7317,8 +7349,84 @@ struct sna_fill_spans {
 	struct sna_damage **damage;
 	int16_t dx, dy;
 	void *op;
+	struct sna_fill_batch *batch;
 };
 
+static inline void
+sna_fill_batch_init(struct sna_fill_spans *data, struct sna_fill_batch *batch)
+{
+	batch->num = 0;
+	data->batch = USE_FILL_BATCH ? batch : NULL;
+}
+
+static void
+sna_fill_batch_flush(DrawablePtr drawable, GCPtr gc,
+		     struct sna_fill_spans *data)
+{
+	struct sna_fill_batch *batch = data->batch;
+
+	if (batch == NULL || batch->num == 0)
+		return;
+
+	DBG(("%s: color=%08x, count=%d\n",
+	     __FUNCTION__, batch->color, batch->num));
+
+	(void)sna_poly_fill_rect_blt(drawable,
+				     data->bo, NULL,
+				     gc, batch->color,
+				     batch->num, batch->rect,
+				     &data->region.extents,
+				     IS_CLIPPED);
+	batch->num = 0;
+}
+
+static bool
+sna_fill_batch_begin(DrawablePtr drawable, GCPtr gc,
+		     struct sna_fill_spans *data, uint32_t color)
+{
+	struct sna_fill_batch *batch = data->batch;
+
+	if (batch == NULL)
+		return false;
+
+	if (batch->num && batch->color != color)
+		sna_fill_batch_flush(drawable, gc, data);
+
+	batch->color = color;
+	return true;
+}
+
+static void
+sna_fill_batch_add(DrawablePtr drawable, GCPtr gc,
+		   struct sna_fill_spans *data,
+		   int16_t x, int16_t y, uint16_t w, uint16_t h)
+{
+	struct sna_fill_batch *batch = data->batch;
+	xRectangle *r;
+
+	if (w == 0 || h == 0)
+		return;
+
+	/* Wide lines produce runs of identical spans, merge them */
+	if (batch->num) {
+		r = &batch->rect[batch->num - 1];
+		if (r->x == x && r->width == w && r->y + r->height == y &&
+		    r->height + h <= UINT16_MAX) {
+			r->height += h;
+			return;
+		}
+	}
+
+	if (batch->num == ARRAY_SIZE(batch->rect))
+		sna_fill_batch_flush(drawable, gc, data);
+
+	r = &batch->rect[batch->num++];
+	r->x = x;
+	r->y = y;
+	r->width = w;
+	r->height = h;
+}
+
 static void
 sna_poly_point__cpu(DrawablePtr drawable, GCPtr gc,
 		    int mode, int n, DDXPointPtr pt)
@@ -7374,6 +7482,7 @@ sna_poly_point__gpu(DrawablePtr drawable, GCPtr gc,
 	BoxRec box[512];
 	DDXPointRec last;
 
+	sna_fill_batch_flush(drawable, gc, data);
 	if (!sna_fill_init_blt(&fill,
 			       data->sna, data->pixmap,
 			       data->bo, gc->alu, gc->fgPixel,
@@ -8100,6 +8209,19 @@ sna_fill_spans__gpu(DrawablePtr drawable, GCPtr gc, int n,
 	 * within the clip, so we must run them through the clipper.
 	 */
 
+	if (gc_is_solid(gc, &color) &&
+	    sna_fill_batch_begin(drawable, gc, data, color)) {
+		do {
+			sna_fill_batch_add(drawable, gc, data,
+					   pt->x - drawable->x,
+					   pt->y - drawable->y,
+					   *width, 1);
+			pt++, width++;
+		} while (--n);
+		return;
+	}
+
+	sna_fill_batch_flush(drawable, gc, data);
 	if (gc_is_solid(gc, &color)) {
 		sna_fill_spans_blt(drawable,
 				   data->bo, NULL,
@@ -8333,6 +8455,16 @@ struct sna_copy_plane {
 	struct kgem_bo *bo;
 };
 
+/* Bytes of word-padded 1bpp data for XY_MONO_SRC_COPY of the box */
+static inline int
+copy_plane_box_size(const BoxRec *box, int sx)
+{
+	int bx1 = (box->x1 + sx) & ~7;
+	int bx2 = (box->x2 + sx + 7) & ~7;
+
+	return ALIGN(ALIGN((bx2 - bx1)/8, 2) * (box->y2 - box->y1), 8);
+}
+
 static void
 sna_copy_bitmap_blt(DrawablePtr _bitmap, DrawablePtr drawable, GCPtr gc,
 		    RegionRec *region, int sx, int sy,
@@ -8345,7 +8477,7 @@ sna_copy_bitmap_blt(DrawablePtr _bitmap, DrawablePtr drawable, GCPtr gc,
 	uint32_t br00, br13;
 	int16_t dx, dy;
 	const BoxRec *box;
-	int n;
+	int n, i, size, offset;
 
 	DBG(("%s: plane=%x (%d,%d),(%d,%d)xld\n",
 	     __FUNCTION__, (unsigned)bitplane,
@@ -8373,113 +8505,194 @@ sna_copy_bitmap_blt(DrawablePtr _bitmap, DrawablePtr drawable, GCPtr gc,
 
 	kgem_set_mode(&sna->kgem, KGEM_BLT, arg->bo);
 	assert(kgem_bo_can_blt(&sna->kgem, arg->bo));
+
 	do {
-		int bx1 = (box->x1 + sx) & ~7;
-		int bx2 = (box->x2 + sx + 7) & ~7;
-		int bw = (bx2 - bx1)/8;
-		int bh = box->y2 - box->y1;
-		int bstride = ALIGN(bw, 2);
-		int src_stride;
-		uint8_t *dst, *src;
-		uint32_t *b;
+		struct kgem_bo *upload = NULL;
+		int count, len, first = 0;
+		bool stop = false;
+
+		/* Small boxes are sent inline, the rest share an upload.
+		 * That is capped so that a large, heavily clipped request
+		 * still fits, and cut back to a single box should even the
+		 * capped allocation fail.
+		 */
+		size = 0;
+		for (count = 0; count < n; count++) {
+			len = copy_plane_box_size(&box[count], sx);
+			if (len <= 128)
+				continue;
+			if (size && size + len > sna->kgem.max_upload_tile_size)
+				break;
+			if (size == 0)
+				first = count;
+			size += len;
+		}
+		if (size) {
+			void *map;
 
-		DBG(("%s: box(%d, %d), (%d, %d), sx=(%d,%d) bx=[%d, %d]\n",
-		     __FUNCTION__,
-		     box->x1, box->y1,
-		     box->x2, box->y2,
-		     sx, sy, bx1, bx2));
-
-		src_stride = bstride*bh;
-		assert(src_stride > 0);
-		if (src_stride <= 128) {
-			src_stride = ALIGN(src_stride, 8) / 4;
-			assert(src_stride <= 32);
-			if (!kgem_check_batch(&sna->kgem, 8+src_stride) ||
-			    !kgem_check_bo_fenced(&sna->kgem, arg->bo) ||
-			    !kgem_check_reloc(&sna->kgem, 1)) {
-				kgem_submit(&sna->kgem);
-				if (!kgem_check_bo_fenced(&sna->kgem, arg->bo))
-					return; /* XXX fallback? */
-				_kgem_set_mode(&sna->kgem, KGEM_BLT);
+			upload = kgem_create_buffer(&sna->kgem, size,
+						    KGEM_BUFFER_WRITE_INPLACE,
+						    &map);
+			len = copy_plane_box_size(&box[first], sx);
+			if (upload == NULL && size > len) {
+				DBG(("%s: failed to upload %d bytes, retrying box %d alone\n",
+				     __FUNCTION__, size, first));
+				count = first + 1;
+				size = len;
+				upload = kgem_create_buffer(&sna->kgem, size,
+							    KGEM_BUFFER_WRITE_INPLACE,
+							    &map);
 			}
-			kgem_bcs_set_tiling(&sna->kgem, NULL, arg->bo);
+			if (upload && sigtrap_get() == 0) {
+				uint8_t *dst = map;
+
+				for (i = first; i < count; i++) {
+					int bx1 = (box[i].x1 + sx) & ~7;
+					int bx2 = (box[i].x2 + sx + 7) & ~7;
+					int bstride = ALIGN((bx2 - bx1)/8, 2);
+					int bh = box[i].y2 - box[i].y1;
+					int src_stride;
+					uint8_t *src;
+
+					if (bstride * bh <= 128)
+						continue;
 
-			assert(sna->kgem.mode == KGEM_BLT);
-			if (sna->kgem.gen >= 0100) {
-				b = sna->kgem.batch + sna->kgem.nbatch;
-				b[0] = XY_MONO_SRC_COPY_IMM | (6 + src_stride) | br00;
-				b[0] |= ((box->x1 + sx) & 7) << 17;
-				b[1] = br13;
-				b[2] = (box->y1 + dy) << 16 | (box->x1 + dx);
-				b[3] = (box->y2 + dy) << 16 | (box->x2 + dx);
-				*(uint64_t *)(b+4) =
-					kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 4, arg->bo,
-							 I915_GEM_DOMAIN_RENDER << 16 |
-							 I915_GEM_DOMAIN_RENDER |
-							 KGEM_RELOC_FENCED,
-							 0);
-				b[6] = gc->bgPixel;
-				b[7] = gc->fgPixel;
+					assert(bitmap->devKind);
+					src_stride = bitmap->devKind;
+					src = bitmap->devPrivate.ptr;
+					src += (box[i].y1 + sy) * src_stride + bx1/8;
+					src_stride -= bstride;
+					do {
+						int j = bstride;
+						assert(src >= (uint8_t *)bitmap->devPrivate.ptr);
+						do {
+							*dst++ = byte_reverse(*src++);
+							*dst++ = byte_reverse(*src++);
+							j -= 2;
+						} while (j);
+						assert(src <= (uint8_t *)bitmap->devPrivate.ptr + bitmap->devKind * bitmap->drawable.height);
+						src += src_stride;
+					} while (--bh);
 
-				dst = (uint8_t *)&b[8];
-				sna->kgem.nbatch += 8 + src_stride;
+					dst = (uint8_t *)map + ALIGN(dst - (uint8_t *)map, 8);
+				}
+				assert(dst <= (uint8_t *)map + kgem_bo_size(upload));
+				sigtrap_put();
 			} else {
-				b = sna->kgem.batch + sna->kgem.nbatch;
-				b[0] = XY_MONO_SRC_COPY_IMM | (5 + src_stride) | br00;
-				b[0] |= ((box->x1 + sx) & 7) << 17;
-				b[1] = br13;
-				b[2] = (box->y1 + dy) << 16 | (box->x1 + dx);
-				b[3] = (box->y2 + dy) << 16 | (box->x2 + dx);
-				b[4] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 4, arg->bo,
-						      I915_GEM_DOMAIN_RENDER << 16 |
-						      I915_GEM_DOMAIN_RENDER |
-						      KGEM_RELOC_FENCED,
-						      0);
-				b[5] = gc->bgPixel;
-				b[6] = gc->fgPixel;
-
-				dst = (uint8_t *)&b[7];
-				sna->kgem.nbatch += 7 + src_stride;
+				/* Draw the inline boxes ahead of the one we
+				 * cannot upload, as the per-box path did.
+				 */
+				if (upload) {
+					kgem_bo_destroy(&sna->kgem, upload);
+					upload = NULL;
+				}
+				count = first;
+				stop = true;
 			}
+		}
 
-			assert(bitmap->devKind);
-			src_stride = bitmap->devKind;
-			src = bitmap->devPrivate.ptr;
-			src += (box->y1 + sy) * src_stride + bx1/8;
-			src_stride -= bstride;
-			do {
-				int i = bstride;
-				assert(src >= (uint8_t *)bitmap->devPrivate.ptr);
-				do {
-					*dst++ = byte_reverse(*src++);
-					*dst++ = byte_reverse(*src++);
-					i -= 2;
-				} while (i);
-				assert(src <= (uint8_t *)bitmap->devPrivate.ptr + bitmap->devKind * bitmap->drawable.height);
-				src += src_stride;
-			} while (--bh);
-		} else {
-			struct kgem_bo *upload;
-			void *ptr;
+		offset = 0;
+		for (i = 0; i < count; i++, box++) {
+			int bx1 = (box->x1 + sx) & ~7;
+			int bx2 = (box->x2 + sx + 7) & ~7;
+			int bw = (bx2 - bx1)/8;
+			int bh = box->y2 - box->y1;
+			int bstride = ALIGN(bw, 2);
+			int src_stride;
+			uint8_t *dst, *src;
+			uint32_t *b;
 
-			if (!kgem_check_batch(&sna->kgem, 10) ||
-			    !kgem_check_bo_fenced(&sna->kgem, arg->bo) ||
-			    !kgem_check_reloc_and_exec(&sna->kgem, 2)) {
-				kgem_submit(&sna->kgem);
-				if (!kgem_check_bo_fenced(&sna->kgem, arg->bo))
-					return; /* XXX fallback? */
-				_kgem_set_mode(&sna->kgem, KGEM_BLT);
-			}
-			kgem_bcs_set_tiling(&sna->kgem, NULL, arg->bo);
+			DBG(("%s: box(%d, %d), (%d, %d), sx=(%d,%d) bx=[%d, %d]\n",
+			     __FUNCTION__,
+			     box->x1, box->y1,
+			     box->x2, box->y2,
+			     sx, sy, bx1, bx2));
 
-			upload = kgem_create_buffer(&sna->kgem,
-						    bstride*bh,
-						    KGEM_BUFFER_WRITE_INPLACE,
-						    &ptr);
-			if (!upload)
-				break;
+			src_stride = bstride*bh;
+			assert(src_stride > 0);
+			if (src_stride <= 128) {
+				src_stride = ALIGN(src_stride, 8) / 4;
+				assert(src_stride <= 32);
+				if (!kgem_check_batch(&sna->kgem, 8+src_stride) ||
+				    !kgem_check_bo_fenced(&sna->kgem, arg->bo) ||
+				    !kgem_check_reloc(&sna->kgem, 1)) {
+					kgem_submit(&sna->kgem);
+					if (!kgem_check_bo_fenced(&sna->kgem, arg->bo)) {
+						stop = true;
+						break; /* XXX fallback? */
+					}
+					_kgem_set_mode(&sna->kgem, KGEM_BLT);
+				}
+				kgem_bcs_set_tiling(&sna->kgem, NULL, arg->bo);
+
+				assert(sna->kgem.mode == KGEM_BLT);
+				if (sna->kgem.gen >= 0100) {
+					b = sna->kgem.batch + sna->kgem.nbatch;
+					b[0] = XY_MONO_SRC_COPY_IMM | (6 + src_stride) | br00;
+					b[0] |= ((box->x1 + sx) & 7) << 17;
+					b[1] = br13;
+					b[2] = (box->y1 + dy) << 16 | (box->x1 + dx);
+					b[3] = (box->y2 + dy) << 16 | (box->x2 + dx);
+					*(uint64_t *)(b+4) =
+						kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 4, arg->bo,
+								 I915_GEM_DOMAIN_RENDER << 16 |
+								 I915_GEM_DOMAIN_RENDER |
+								 KGEM_RELOC_FENCED,
+								 0);
+					b[6] = gc->bgPixel;
+					b[7] = gc->fgPixel;
+
+					dst = (uint8_t *)&b[8];
+					sna->kgem.nbatch += 8 + src_stride;
+				} else {
+					b = sna->kgem.batch + sna->kgem.nbatch;
+					b[0] = XY_MONO_SRC_COPY_IMM | (5 + src_stride) | br00;
+					b[0] |= ((box->x1 + sx) & 7) << 17;
+					b[1] = br13;
+					b[2] = (box->y1 + dy) << 16 | (box->x1 + dx);
+					b[3] = (box->y2 + dy) << 16 | (box->x2 + dx);
+					b[4] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 4, arg->bo,
+							      I915_GEM_DOMAIN_RENDER << 16 |
+							      I915_GEM_DOMAIN_RENDER |
+							      KGEM_RELOC_FENCED,
+							      0);
+					b[5] = gc->bgPixel;
+					b[6] = gc->fgPixel;
+
+					dst = (uint8_t *)&b[7];
+					sna->kgem.nbatch += 7 + src_stride;
+				}
+
+				assert(bitmap->devKind);
+				src_stride = bitmap->devKind;
+				src = bitmap->devPrivate.ptr;
+				src += (box->y1 + sy) * src_stride + bx1/8;
+				src_stride -= bstride;
+				do {
+					int j = bstride;
+					assert(src >= (uint8_t *)bitmap->devPrivate.ptr);
+					do {
+						*dst++ = byte_reverse(*src++);
+						*dst++ = byte_reverse(*src++);
+						j -= 2;
+					} while (j);
+					assert(src <= (uint8_t *)bitmap->devPrivate.ptr + bitmap->devKind * bitmap->drawable.height);
+					src += src_stride;
+				} while (--bh);
+			} else {
+				assert(upload);
+				if (!kgem_check_batch(&sna->kgem, 10) ||
+				    !kgem_check_bo_fenced(&sna->kgem, arg->bo) ||
+				    !kgem_check_reloc_and_exec(&sna->kgem, 2)) {
+					kgem_submit(&sna->kgem);
+					if (!kgem_check_bo_fenced(&sna->kgem, arg->bo)) {
+						stop = true;
+						break; /* XXX fallback? */
+					}
+					_kgem_set_mode(&sna->kgem, KGEM_BLT);
+				}
+				kgem_bcs_set_tiling(&sna->kgem, NULL, arg->bo);
 
-			if (sigtrap_get() == 0) {
 				assert(sna->kgem.mode == KGEM_BLT);
 				b = sna->kgem.batch + sna->kgem.nbatch;
 				if (sna->kgem.gen >= 0100) {
@@ -8498,7 +8711,7 @@ sna_copy_bitmap_blt(DrawablePtr _bitmap, DrawablePtr drawable, GCPtr gc,
 						kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 6, upload,
 								I915_GEM_DOMAIN_RENDER << 16 |
 								KGEM_RELOC_FENCED,
-								0);
+								offset);
 					b[8] = gc->bgPixel;
 					b[9] = gc->fgPixel;
 
@@ -8517,40 +8730,21 @@ sna_copy_bitmap_blt(DrawablePtr _bitmap, DrawablePtr drawable, GCPtr gc,
 					b[5] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 5, upload,
 							I915_GEM_DOMAIN_RENDER << 16 |
 							KGEM_RELOC_FENCED,
-							0);
+							offset);
 					b[6] = gc->bgPixel;
 					b[7] = gc->fgPixel;
 
 					sna->kgem.nbatch += 8;
 				}
 
-				dst = ptr;
-				assert(bitmap->devKind);
-				src_stride = bitmap->devKind;
-				src = bitmap->devPrivate.ptr;
-				src += (box->y1 + sy) * src_stride + bx1/8;
-				src_stride -= bstride;
-				do {
-					int i = bstride;
-					assert(src >= (uint8_t *)bitmap->devPrivate.ptr);
-					do {
-						*dst++ = byte_reverse(*src++);
-						*dst++ = byte_reverse(*src++);
-						i -= 2;
-					} while (i);
-					assert(src <= (uint8_t *)bitmap->devPrivate.ptr + bitmap->devKind * bitmap->drawable.height);
-					assert(dst <= (uint8_t *)ptr + kgem_bo_size(upload));
-					src += src_stride;
-				} while (--bh);
-
-				sigtrap_put();
+				offset += ALIGN(bstride * (box->y2 - box->y1), 8);
 			}
-
-			kgem_bo_destroy(&sna->kgem, upload);
 		}
+		if (upload)
+			kgem_bo_destroy(&sna->kgem, upload);
 
-		box++;
-	} while (--n);
+		n -= count;
+	} while (n && !stop);
 
 	if (arg->damage) {
 		RegionTranslate(region, dx, dy);
@@ -8560,6 +8754,123 @@ sna_copy_bitmap_blt(DrawablePtr _bitmap, DrawablePtr drawable, GCPtr gc,
 	blt_done(sna);
 }
 
+/* Pack one bit of each source pixel within box into a 1bpp, msb-first,
+ * word-padded bitmap for XY_MONO_SRC_COPY, returning its size.
+ */
+static int
+copy_plane_pack(PixmapPtr src_pixmap, const BoxRec *box,
+		int sx, int sy, int bit, uint8_t *dst)
+{
+	int bx1 = (box->x1 + sx) & ~7;
+	int bx2 = (box->x2 + sx + 7) & ~7;
+	int bw = (bx2 - bx1)/8;
+	int bh = box->y2 - box->y1;
+	int bstride = ALIGN(bw, 2);
+	int size = bstride * bh;
+
+	bstride -= bw;
+
+	switch (src_pixmap->drawable.bitsPerPixel) {
+	case 32:
+		{
+			uint32_t *src = src_pixmap->devPrivate.ptr;
+			int src_stride = src_pixmap->devKind/sizeof(uint32_t);
+
+			src += (box->y1 + sy) * src_stride;
+			src += bx1;
+
+			src_stride -= bw * 8;
+
+			do {
+				int i = bw;
+				do {
+					uint8_t v = 0;
+
+					v |= ((*src++ >> bit) & 1) << 7;
+					v |= ((*src++ >> bit) & 1) << 6;
+					v |= ((*src++ >> bit) & 1) << 5;
+					v |= ((*src++ >> bit) & 1) << 4;
+					v |= ((*src++ >> bit) & 1) << 3;
+					v |= ((*src++ >> bit) & 1) << 2;
+					v |= ((*src++ >> bit) & 1) << 1;
+					v |= ((*src++ >> bit) & 1) << 0;
+
+					*dst++ = v;
+				} while (--i);
+				dst += bstride;
+				src += src_stride;
+			} while (--bh);
+			break;
+		}
+	case 16:
+		{
+			uint16_t *src = src_pixmap->devPrivate.ptr;
+			int src_stride = src_pixmap->devKind/sizeof(uint16_t);
+
+			src += (box->y1 + sy) * src_stride;
+			src += bx1;
+
+			src_stride -= bw * 8;
+
+			do {
+				int i = bw;
+				do {
+					uint8_t v = 0;
+
+					v |= ((*src++ >> bit) & 1) << 7;
+					v |= ((*src++ >> bit) & 1) << 6;
+					v |= ((*src++ >> bit) & 1) << 5;
+					v |= ((*src++ >> bit) & 1) << 4;
+					v |= ((*src++ >> bit) & 1) << 3;
+					v |= ((*src++ >> bit) & 1) << 2;
+					v |= ((*src++ >> bit) & 1) << 1;
+					v |= ((*src++ >> bit) & 1) << 0;
+
+					*dst++ = v;
+				} while (--i);
+				dst += bstride;
+				src += src_stride;
+			} while (--bh);
+			break;
+		}
+	default:
+		assert(0);
+	case 8:
+		{
+			uint8_t *src = src_pixmap->devPrivate.ptr;
+			int src_stride = src_pixmap->devKind/sizeof(uint8_t);
+
+			src += (box->y1 + sy) * src_stride;
+			src += bx1;
+
+			src_stride -= bw * 8;
+
+			do {
+				int i = bw;
+				do {
+					uint8_t v = 0;
+
+					v |= ((*src++ >> bit) & 1) << 7;
+					v |= ((*src++ >> bit) & 1) << 6;
+					v |= ((*src++ >> bit) & 1) << 5;
+					v |= ((*src++ >> bit) & 1) << 4;
+					v |= ((*src++ >> bit) & 1) << 3;
+					v |= ((*src++ >> bit) & 1) << 2;
+					v |= ((*src++ >> bit) & 1) << 1;
+					v |= ((*src++ >> bit) & 1) << 0;
+
+					*dst++ = v;
+				} while (--i);
+				dst += bstride;
+				src += src_stride;
+			} while (--bh);
+			break;
+		}
+	}
+
+	return size;
+}
+
 static void
 sna_copy_plane_blt(DrawablePtr source, DrawablePtr drawable, GCPtr gc,
 		   RegionPtr region, int sx, int sy,
@@ -8574,6 +8885,9 @@ sna_copy_plane_blt(DrawablePtr source, DrawablePtr drawable, GCPtr gc,
 	uint32_t br00, br13;
 	const BoxRec *box = region_rects(region);
 	int n = region_num_rects(region);
+	struct kgem_bo *upload;
+	int i, size, offset;
+	void *ptr;
 
 	DBG(("%s: plane=%x [%d] x%d\n", __FUNCTION__,
 	     (unsigned)bitplane, bit, n));
@@ -8598,146 +8912,75 @@ sna_copy_plane_blt(DrawablePtr source, DrawablePtr drawable, GCPtr gc,
 
 	kgem_set_mode(&sna->kgem, KGEM_BLT, arg->bo);
 	assert(kgem_bo_can_blt(&sna->kgem, arg->bo));
-	do {
-		int bx1 = (box->x1 + sx) & ~7;
-		int bx2 = (box->x2 + sx + 7) & ~7;
-		int bw = (bx2 - bx1)/8;
-		int bh = box->y2 - box->y1;
-		int bstride = ALIGN(bw, 2);
-		struct kgem_bo *upload;
-		void *ptr;
 
-		DBG(("%s: box(%d, %d), (%d, %d), sx=(%d,%d) bx=[%d, %d]\n",
-		     __FUNCTION__,
-		     box->x1, box->y1,
-		     box->x2, box->y2,
-		     sx, sy, bx1, bx2));
+	assert(src_pixmap->devKind);
+	do {
+		int count, len;
 
-		if (!kgem_check_batch(&sna->kgem, 10) ||
-		    !kgem_check_bo_fenced(&sna->kgem, arg->bo) ||
-		    !kgem_check_reloc_and_exec(&sna->kgem, 2)) {
-			kgem_submit(&sna->kgem);
-			if (!kgem_check_bo_fenced(&sna->kgem, arg->bo))
-				return; /* XXX fallback? */
-			_kgem_set_mode(&sna->kgem, KGEM_BLT);
+		/* Extract the plane for a run of boxes into a single
+		 * upload. That is capped so that a large, heavily clipped
+		 * request still fits, and cut back to a single box should
+		 * even the capped allocation fail.
+		 */
+		size = 0;
+		for (count = 0; count < n; count++) {
+			len = copy_plane_box_size(&box[count], sx);
+			if (count && size + len > sna->kgem.max_upload_tile_size)
+				break;
+			size += len;
 		}
-		kgem_bcs_set_tiling(&sna->kgem, NULL, arg->bo);
 
-		upload = kgem_create_buffer(&sna->kgem,
-					    bstride*bh,
+		upload = kgem_create_buffer(&sna->kgem, size,
 					    KGEM_BUFFER_WRITE_INPLACE,
 					    &ptr);
-		if (!upload)
+		if (upload == NULL && count > 1) {
+			DBG(("%s: failed to upload %d bytes, retrying a single box\n",
+			     __FUNCTION__, size));
+			count = 1;
+			size = copy_plane_box_size(box, sx);
+			upload = kgem_create_buffer(&sna->kgem, size,
+						    KGEM_BUFFER_WRITE_INPLACE,
+						    &ptr);
+		}
+		if (upload == NULL)
 			break;
 
-		if (sigtrap_get() == 0) {
-			uint32_t *b;
-
-			assert(src_pixmap->devKind);
-			switch (source->bitsPerPixel) {
-			case 32:
-				{
-					uint32_t *src = src_pixmap->devPrivate.ptr;
-					int src_stride = src_pixmap->devKind/sizeof(uint32_t);
-					uint8_t *dst = ptr;
-
-					src += (box->y1 + sy) * src_stride;
-					src += bx1;
-
-					src_stride -= bw * 8;
-					bstride -= bw;
-
-					do {
-						int i = bw;
-						do {
-							uint8_t v = 0;
-
-							v |= ((*src++ >> bit) & 1) << 7;
-							v |= ((*src++ >> bit) & 1) << 6;
-							v |= ((*src++ >> bit) & 1) << 5;
-							v |= ((*src++ >> bit) & 1) << 4;
-							v |= ((*src++ >> bit) & 1) << 3;
-							v |= ((*src++ >> bit) & 1) << 2;
-							v |= ((*src++ >> bit) & 1) << 1;
-							v |= ((*src++ >> bit) & 1) << 0;
-
-							*dst++ = v;
-						} while (--i);
-						dst += bstride;
-						src += src_stride;
-					} while (--bh);
-					break;
-				}
-			case 16:
-				{
-					uint16_t *src = src_pixmap->devPrivate.ptr;
-					int src_stride = src_pixmap->devKind/sizeof(uint16_t);
-					uint8_t *dst = ptr;
-
-					src += (box->y1 + sy) * src_stride;
-					src += bx1;
-
-					src_stride -= bw * 8;
-					bstride -= bw;
+		if (sigtrap_get()) {
+			kgem_bo_destroy(&sna->kgem, upload);
+			break;
+		}
 
-					do {
-						int i = bw;
-						do {
-							uint8_t v = 0;
-
-							v |= ((*src++ >> bit) & 1) << 7;
-							v |= ((*src++ >> bit) & 1) << 6;
-							v |= ((*src++ >> bit) & 1) << 5;
-							v |= ((*src++ >> bit) & 1) << 4;
-							v |= ((*src++ >> bit) & 1) << 3;
-							v |= ((*src++ >> bit) & 1) << 2;
-							v |= ((*src++ >> bit) & 1) << 1;
-							v |= ((*src++ >> bit) & 1) << 0;
-
-							*dst++ = v;
-						} while (--i);
-						dst += bstride;
-						src += src_stride;
-					} while (--bh);
-					break;
-				}
-			default:
-				assert(0);
-			case 8:
-				{
-					uint8_t *src = src_pixmap->devPrivate.ptr;
-					int src_stride = src_pixmap->devKind/sizeof(uint8_t);
-					uint8_t *dst = ptr;
+		offset = 0;
+		for (i = 0; i < count; i++) {
+			offset += ALIGN(copy_plane_pack(src_pixmap, &box[i],
+							sx, sy, bit,
+							(uint8_t *)ptr + offset), 8);
+		}
+		sigtrap_put();
 
-					src += (box->y1 + sy) * src_stride;
-					src += bx1;
+		offset = 0;
+		for (i = 0; i < count; i++, box++) {
+			int bx1 = (box->x1 + sx) & ~7;
+			int bx2 = (box->x2 + sx + 7) & ~7;
+			int bstride = ALIGN((bx2 - bx1)/8, 2);
+			uint32_t *b;
 
-					src_stride -= bw * 8;
-					bstride -= bw;
+			DBG(("%s: box(%d, %d), (%d, %d), sx=(%d,%d) bx=[%d, %d]\n",
+			     __FUNCTION__,
+			     box->x1, box->y1,
+			     box->x2, box->y2,
+			     sx, sy, bx1, bx2));
 
-					do {
-						int i = bw;
-						do {
-							uint8_t v = 0;
-
-							v |= ((*src++ >> bit) & 1) << 7;
-							v |= ((*src++ >> bit) & 1) << 6;
-							v |= ((*src++ >> bit) & 1) << 5;
-							v |= ((*src++ >> bit) & 1) << 4;
-							v |= ((*src++ >> bit) & 1) << 3;
-							v |= ((*src++ >> bit) & 1) << 2;
-							v |= ((*src++ >> bit) & 1) << 1;
-							v |= ((*src++ >> bit) & 1) << 0;
-
-							*dst++ = v;
-						} while (--i);
-						dst += bstride;
-						src += src_stride;
-					} while (--bh);
-					break;
+			if (!kgem_check_batch(&sna->kgem, 10) ||
+			    !kgem_check_bo_fenced(&sna->kgem, arg->bo) ||
+			    !kgem_check_reloc_and_exec(&sna->kgem, 2)) {
+				kgem_submit(&sna->kgem);
+				if (!kgem_check_bo_fenced(&sna->kgem, arg->bo)) {
+					kgem_bo_destroy(&sna->kgem, upload);
+					goto done; /* XXX fallback? */
 				}
+				_kgem_set_mode(&sna->kgem, KGEM_BLT);
 			}
-
 			kgem_bcs_set_tiling(&sna->kgem, upload, arg->bo);
 
 			assert(sna->kgem.mode == KGEM_BLT);
@@ -8757,7 +9000,7 @@ sna_copy_plane_blt(DrawablePtr source, DrawablePtr drawable, GCPtr gc,
 					kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 6, upload,
 							I915_GEM_DOMAIN_RENDER << 16 |
 							KGEM_RELOC_FENCED,
-							0);
+							offset);
 				b[8] = gc->bgPixel;
 				b[9] = gc->fgPixel;
 
@@ -8775,19 +9018,21 @@ sna_copy_plane_blt(DrawablePtr source, DrawablePtr drawable, GCPtr gc,
 				b[5] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 5, upload,
 						I915_GEM_DOMAIN_RENDER << 16 |
 						KGEM_RELOC_FENCED,
-						0);
+						offset);
 				b[6] = gc->bgPixel;
 				b[7] = gc->fgPixel;
 
 				sna->kgem.nbatch += 8;
 			}
-			sigtrap_put();
+
+			offset += ALIGN(bstride * (box->y2 - box->y1), 8);
 		}
 		kgem_bo_destroy(&sna->kgem, upload);
 
-		box++;
-	} while (--n);
+		n -= count;
+	} while (n);
 
+done:
 	if (arg->damage) {
 		RegionTranslate(region, dx, dy);
 		sna_damage_add_to_pixmap(arg->damage, region, dst_pixmap);
@@ -10094,6 +10339,8 @@ spans_fallback:
 				}
 			}
 		} else {
+			struct sna_fill_batch batch;
+
 			/* Note that the WideDash functions alternate
 			 * between filling using fgPixel and bgPixel
 			 * so we need to reset state between FillSpans and
@@ -10103,6 +10350,7 @@ spans_fallback:
 			sna_gc_ops__tmp.PolyFillRect = sna_poly_fill_rect__gpu;
 			sna_gc_ops__tmp.PolyPoint = sna_poly_point__gpu;
 			gc->ops = &sna_gc_ops__tmp;
+			sna_fill_batch_init(&data, &batch);
 
 			switch (gc->lineStyle) {
 			default:
@@ -10127,6 +10375,7 @@ spans_fallback:
 				}
 				break;
 			}
+			sna_fill_batch_flush(drawable, gc, &data);
 		}
 
 		gc->ops = (GCOps *)&sna_gc_ops;
@@ -10987,14 +11236,18 @@ spans_fallback:
 
 			fill.done(data.sna, &fill);
 		} else {
+			struct sna_fill_batch batch;
+
 			sna_gc_ops__tmp.FillSpans = sna_fill_spans__gpu;
 			sna_gc_ops__tmp.PolyFillRect = sna_poly_fill_rect__gpu;
 			sna_gc_ops__tmp.PolyPoint = sna_poly_point__gpu;
 			gc->ops = &sna_gc_ops__tmp;
+			sna_fill_batch_init(&data, &batch);
 
 			for (i = 0; i < n; i++)
 				line(drawable, gc, CoordModeOrigin, 2,
 				     (DDXPointPtr)&seg[i]);
+			sna_fill_batch_flush(drawable, gc, &data);
 		}
 
 		gc->ops = (GCOps *)&sna_gc_ops;
@@ -11793,18 +12046,23 @@ sna_poly_arc(DrawablePtr drawable, GCPtr gc, int n, xArc *arc)
 
 				fill.done(data.sna, &fill);
 			} else {
+				struct sna_fill_batch batch;
+
 				if (!region_maybe_clip(&data.region,
 						       gc->pCompositeClip))
 					return;
 
 				sna_gc_ops__tmp.FillSpans = sna_fill_spans__gpu;
+				sna_gc_ops__tmp.PolyFillRect = sna_poly_fill_rect__gpu;
 				sna_gc_ops__tmp.PolyPoint = sna_poly_point__gpu;
 
 				gc->ops = &sna_gc_ops__tmp;
+				sna_fill_batch_init(&data, &batch);
 				if (gc->lineWidth == 0)
 					miZeroPolyArc(drawable, gc, n, arc);
 				else
 					miPolyArc(drawable, gc, n, arc);
+				sna_fill_batch_flush(drawable, gc, &data);
 				gc->ops = (GCOps *)&sna_gc_ops;
 			}
 
@@ -12211,6 +12469,7 @@ sna_poly_fill_polygon(DrawablePtr draw, GCPtr gc,
 		} else {
 			sna_gc_ops__tmp.FillSpans = sna_fill_spans__gpu;
 			gc->ops = &sna_gc_ops__tmp;
+			data.batch = NULL;
 
 			miFillPolygon(draw, gc, shape, mode, n, pt);
 		}
@@ -15192,6 +15451,17 @@ sna_poly_fill_rect__gpu(DrawablePtr draw, GCPtr gc, int n, xRectangle *r)
 	 * within the clip, so we must run them through the clipper.
 	 */
 
+	if (gc_is_solid(gc, &color) &&
+	    sna_fill_batch_begin(draw, gc, data, color)) {
+		do {
+			sna_fill_batch_add(draw, gc, data,
+					   r->x, r->y, r->width, r->height);
+			r++;
+		} while (--n);
+		return;
+	}
+
+	sna_fill_batch_flush(draw, gc, data);
 	if (gc_is_solid(gc, &color)) {
 		(void)sna_poly_fill_rect_blt(draw,
 					     data->bo, NULL,
@@ -15303,6 +15573,7 @@ sna_poly_fill_arc(DrawablePtr draw, GCPtr gc, int n, xArc *arc)
 		} else {
 			sna_gc_ops__tmp.FillSpans = sna_fill_spans__gpu;
 			gc->ops = &sna_gc_ops__tmp;
+			data.batch = NULL;
 
 			miPolyFillArc(draw, gc, n, arc);
 		}
@@ -15348,10 +15619,106 @@ out:
 struct sna_font {
 	CharInfoRec glyphs8[256];
 	CharInfoRec *glyphs16[256];
+
+	/* Bitmaps of the larger glyphs, referenced by XY_TEXT_BLT */
+	struct kgem_bo *atlas;
+	uint32_t atlas_used;
 };
 #define GLYPH_INVALID (void *)1
 #define GLYPH_EMPTY (void *)2
 
+/* Below this many bytes, inlining the glyph with XY_TEXT_IMMEDIATE_BLT
+ * costs less than the relocation for a copy out of the atlas.
+ */
+#define GLYPH_ATLAS_MIN_BYTES 32
+#define GLYPH_ATLAS_ALIGN 64
+#define GLYPH_ATLAS_SIZE (64*1024)
+
+static inline int glyph_bytes(CharInfoPtr c)
+{
+	return (((GLYPHWIDTHPIXELS(c) + 7) >> 3) * GLYPHHEIGHTPIXELS(c) + 7) & ~7;
+}
+
+/* The atlas offset (| 1 once uploaded) is stored after the bitmap, and
+ * returned in that form by sna_glyph_atlas_upload(), or 0 if the glyph
+ * could not be uploaded.
+ */
+static inline uint32_t *glyph_atlas_offset(CharInfoPtr c)
+{
+	return (uint32_t *)((uint8_t *)c->bits + glyph_bytes(c));
+}
+
+static uint32_t
+sna_glyph_atlas_upload(struct sna *sna, struct sna_font *font, CharInfoPtr c)
+{
+	uint32_t *offset = glyph_atlas_offset(c);
+	int len = glyph_bytes(c);
+	uint8_t *ptr;
+
+	if (*offset)
+		return *offset;
+
+	if (font->atlas_used + len > GLYPH_ATLAS_SIZE)
+		return 0;
+
+	/* Only ever append to the atlas, so that we never write to a
+	 * region the GPU may still be reading from.
+	 */
+	ptr = kgem_bo_map__async(&sna->kgem, font->atlas);
+	if (ptr == NULL)
+		return 0;
+
+	if (sigtrap_get())
+		return 0;
+
+	memcpy(ptr + font->atlas_used, c->bits, len);
+	sigtrap_put();
+
+	DBG(("%s: uploaded %d bytes to offset %d\n",
+	     __FUNCTION__, len, font->atlas_used));
+
+	*offset = font->atlas_used | 1;
+	font->atlas_used += ALIGN(len, GLYPH_ATLAS_ALIGN);
+	return *offset;
+}
+
+static struct kgem_bo *
+sna_font_get_atlas(struct sna *sna, FontPtr font)
+{
+	struct sna_font *priv;
+	int top, bot, width;
+
+	if (!USE_GLYPH_ATLAS || font == NULL)
+		return NULL;
+
+	priv = FontGetPrivate(font, sna_font_key);
+	if (priv == NULL)
+		return NULL;
+
+	if (priv->atlas)
+		return priv->atlas;
+
+	/* atlas_used without an atlas marks a font we decided against */
+	if (priv->atlas_used)
+		return NULL;
+
+	top = max(FONTMAXBOUNDS(font, ascent), FONTASCENT(font));
+	bot = max(FONTMAXBOUNDS(font, descent), FONTDESCENT(font));
+	width = max(FONTMAXBOUNDS(font, characterWidth), -FONTMINBOUNDS(font, characterWidth));
+	if ((top + bot) * (width + 7)/8 < GLYPH_ATLAS_MIN_BYTES) {
+		priv->atlas_used = GLYPH_ATLAS_SIZE;
+		return NULL;
+	}
+
+	priv->atlas = kgem_create_linear(&sna->kgem, GLYPH_ATLAS_SIZE, 0);
+	if (priv->atlas == NULL)
+		priv->atlas_used = GLYPH_ATLAS_SIZE;
+
+	DBG(("%s: created atlas handle=%d\n", __FUNCTION__,
+	     priv->atlas ? priv->atlas->handle : 0));
+	return priv->atlas;
+}
+
 static Bool
 sna_realize_font(ScreenPtr screen, FontPtr font)
 {
@@ -15382,6 +15749,9 @@ sna_unrealize_font(ScreenPtr screen, FontPtr font)
 	if (priv == NULL)
 		return TRUE;
 
+	if (priv->atlas)
+		kgem_bo_destroy(&to_sna_from_screen(screen)->kgem, priv->atlas);
+
 	for (i = 0; i < 256; i++) {
 		if ((uintptr_t)priv->glyphs8[i].bits & ~3)
 			free(priv->glyphs8[i].bits);
@@ -15412,12 +15782,13 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 {
 	PixmapPtr pixmap = get_drawable_pixmap(drawable);
 	struct sna *sna = to_sna_from_pixmap(pixmap);
-	struct kgem_bo *bo;
+	struct sna_font *font = NULL;
+	struct kgem_bo *bo, *atlas;
 	struct sna_damage **damage;
 	const BoxRec *extents, *last_extents;
 	uint32_t *b;
 	int16_t dx, dy;
-	uint32_t br00;
+	uint32_t br00, br00_atlas;
 	uint16_t unwind_batch, unwind_reloc;
 	unsigned hint;
 
@@ -15471,13 +15842,17 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 		}
 	}
 
+	atlas = sna_font_get_atlas(sna, gc->font);
+	if (atlas)
+		font = FontGetPrivate(gc->font, sna_font_key);
+
 	kgem_set_mode(&sna->kgem, KGEM_BLT, bo);
 	assert(kgem_bo_can_blt(&sna->kgem, bo));
 	if (!kgem_check_batch(&sna->kgem, 20) ||
-	    !kgem_check_bo_fenced(&sna->kgem, bo) ||
-	    !kgem_check_reloc(&sna->kgem, 1)) {
+	    !kgem_check_many_bo_fenced(&sna->kgem, bo, atlas, NULL) ||
+	    !kgem_check_reloc(&sna->kgem, 2)) {
 		kgem_submit(&sna->kgem);
-		if (!kgem_check_bo_fenced(&sna->kgem, bo)) {
+		if (!kgem_check_many_bo_fenced(&sna->kgem, bo, atlas, NULL)) {
 			RegionTranslate(clip, -dx, -dy);
 			return false;
 		}
@@ -15538,8 +15913,11 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 	}
 
 	br00 = XY_TEXT_IMMEDIATE_BLT;
-	if (bo->tiling && sna->kgem.gen >= 040)
+	br00_atlas = XY_TEXT_BLT | (sna->kgem.gen >= 0100 ? 3 : 2);
+	if (bo->tiling && sna->kgem.gen >= 040) {
 		br00 |= BLT_DST_TILED;
+		br00_atlas |= BLT_DST_TILED;
+	}
 
 	do {
 		CharInfoPtr *info = _info;
@@ -15550,7 +15928,8 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 			int w = GLYPHWIDTHPIXELS(c);
 			int h = GLYPHHEIGHTPIXELS(c);
 			int w8 = (w + 7) >> 3;
-			int x1, y1, len;
+			int x1, y1, len, need;
+			uint32_t offset;
 
 			if (c->bits == GLYPH_EMPTY)
 				goto skip;
@@ -15568,7 +15947,13 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 				goto skip;
 
 			assert(len > 0);
-			if (!kgem_check_batch(&sna->kgem, 3+len)) {
+			offset = 0;
+			if (atlas && 4*len >= GLYPH_ATLAS_MIN_BYTES)
+				offset = sna_glyph_atlas_upload(sna, font, c);
+			need = offset ? (sna->kgem.gen >= 0100 ? 5 : 4) : 3 + len;
+
+			if (!kgem_check_batch(&sna->kgem, need) ||
+			    !kgem_check_reloc(&sna->kgem, 1)) {
 				_kgem_submit(&sna->kgem);
 				_kgem_set_mode(&sna->kgem, KGEM_BLT);
 				kgem_bcs_set_tiling(&sna->kgem, NULL, bo);
@@ -15628,18 +16013,36 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 
 			assert(sna->kgem.mode == KGEM_BLT);
 			b = sna->kgem.batch + sna->kgem.nbatch;
-			sna->kgem.nbatch += 3 + len;
+			if (offset) {
+				b[0] = br00_atlas;
+				b[1] = (uint16_t)y1 << 16 | (uint16_t)x1;
+				b[2] = (uint16_t)(y1+h) << 16 | (uint16_t)(x1+w);
+				if (sna->kgem.gen >= 0100)
+					*(uint64_t *)(b+3) =
+						kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 3, atlas,
+								 I915_GEM_DOMAIN_RENDER << 16 |
+								 KGEM_RELOC_FENCED,
+								 offset & ~1);
+				else
+					b[3] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 3, atlas,
+							      I915_GEM_DOMAIN_RENDER << 16 |
+							      KGEM_RELOC_FENCED,
+							      offset & ~1);
+				sna->kgem.nbatch += need;
+			} else {
+				sna->kgem.nbatch += 3 + len;
 
-			b[0] = br00 | (1 + len);
-			b[1] = (uint16_t)y1 << 16 | (uint16_t)x1;
-			b[2] = (uint16_t)(y1+h) << 16 | (uint16_t)(x1+w);
-			{
-				uint64_t *src = (uint64_t *)c->bits;
-				uint64_t *dst = (uint64_t *)(b + 3);
-				do  {
-					*dst++ = *src++;
-					len -= 2;
-				} while (len);
+				b[0] = br00 | (1 + len);
+				b[1] = (uint16_t)y1 << 16 | (uint16_t)x1;
+				b[2] = (uint16_t)(y1+h) << 16 | (uint16_t)(x1+w);
+				{
+					uint64_t *src = (uint64_t *)c->bits;
+					uint64_t *dst = (uint64_t *)(b + 3);
+					do  {
+						*dst++ = *src++;
+						len -= 2;
+					} while (len);
+				}
 			}
 
 			if (damage) {
@@ -15742,11 +16145,13 @@ static bool sna_set_glyph(CharInfoPtr in, CharInfoPtr out)
 
 	w = (w + 7) >> 3;
 
-	out->bits = malloc((w*h + 7) & ~7);
+	/* with room for the atlas offset following the bitmap */
+	out->bits = malloc(((w*h + 7) & ~7) + 8);
 	if (out->bits == NULL)
 		return false;
 
-	VG(memset(out->bits, 0, (w*h + 7) & ~7));
+	VG(memset(out->bits, 0, ((w*h + 7) & ~7) + 8));
+	*glyph_atlas_offset(out) = 0;
 	src = (uint8_t *)in->bits;
 	dst = (uint8_t *)out->bits;
 	stride -= w;
@@ -16618,11 +17023,13 @@ sna_push_pixels_solid_blt(GCPtr gc,
 	PixmapPtr pixmap = get_drawable_pixmap(drawable);
 	struct sna *sna = to_sna_from_pixmap(pixmap);
 	struct sna_damage **damage;
-	struct kgem_bo *bo;
+	struct kgem_bo *bo, *upload;
 	const BoxRec *box;
 	int16_t dx, dy;
-	int n;
+	int n, i, size, offset;
 	uint8_t rop = copy_ROP[gc->alu];
+	uint8_t *dst;
+	void *ptr;
 
 	bo = sna_drawable_use_bo(drawable, PREFER_GPU, &region->extents, &damage);
 	if (bo == NULL)
@@ -16642,6 +17049,59 @@ sna_push_pixels_solid_blt(GCPtr gc,
 	if (!kgem_bo_can_blt(&sna->kgem, bo))
 		return false;
 
+	/* Each XY_MONO_SRC_COPY reads its own packed bitmap, so rather
+	 * than allocating an upload per box, pack the bitmap for every
+	 * box into a single buffer and point each command into it.
+	 */
+	box = region_rects(region);
+	n = region_num_rects(region);
+	size = 0;
+	for (i = 0; i < n; i++) {
+		int bx1 = (box[i].x1 - region->extents.x1) & ~7;
+		int bx2 = (box[i].x2 - region->extents.x1 + 7) & ~7;
+		int bstride = ALIGN((bx2 - bx1)/8, 2);
+		size += ALIGN(bstride * (box[i].y2 - box[i].y1), 8);
+	}
+
+	upload = kgem_create_buffer(&sna->kgem, size,
+				    KGEM_BUFFER_WRITE_INPLACE,
+				    &ptr);
+	if (!upload)
+		return false;
+
+	if (sigtrap_get()) {
+		kgem_bo_destroy(&sna->kgem, upload);
+		return false;
+	}
+
+	dst = ptr;
+	for (i = 0; i < n; i++) {
+		int bx1 = (box[i].x1 - region->extents.x1) & ~7;
+		int bx2 = (box[i].x2 - region->extents.x1 + 7) & ~7;
+		int bstride = ALIGN((bx2 - bx1)/8, 2);
+		int bh = box[i].y2 - box[i].y1;
+		int src_stride = bitmap->devKind;
+		uint8_t *src;
+
+		assert(src_stride);
+		src = (uint8_t*)bitmap->devPrivate.ptr;
+		src += (box[i].y1 - region->extents.y1) * src_stride + bx1/8;
+		src_stride -= bstride;
+		do {
+			int j = bstride;
+			do {
+				*dst++ = byte_reverse(*src++);
+				*dst++ = byte_reverse(*src++);
+				j -= 2;
+			} while (j);
+			src += src_stride;
+		} while (--bh);
+
+		dst = (uint8_t *)ptr + ALIGN(dst - (uint8_t *)ptr, 8);
+	}
+	assert(dst <= (uint8_t *)ptr + kgem_bo_size(upload));
+	sigtrap_put();
+
 	if (get_drawable_deltas(drawable, pixmap, &dx, &dy))
 		RegionTranslate(region, dx, dy);
 
@@ -16659,119 +17119,89 @@ sna_push_pixels_solid_blt(GCPtr gc,
 	kgem_bcs_set_tiling(&sna->kgem, NULL, bo);
 
 	/* Region is pre-clipped and translated into pixmap space */
-	box = region_rects(region);
-	n = region_num_rects(region);
+	offset = 0;
 	do {
 		int bx1 = (box->x1 - region->extents.x1) & ~7;
 		int bx2 = (box->x2 - region->extents.x1 + 7) & ~7;
-		int bw = (bx2 - bx1)/8;
-		int bh = box->y2 - box->y1;
-		int bstride = ALIGN(bw, 2);
-		struct kgem_bo *upload;
-		void *ptr;
+		int bstride = ALIGN((bx2 - bx1)/8, 2);
+		uint32_t *b;
 
 		if (!kgem_check_batch(&sna->kgem, 10) ||
 		    !kgem_check_bo_fenced(&sna->kgem, bo) ||
 		    !kgem_check_reloc_and_exec(&sna->kgem, 2)) {
 			kgem_submit(&sna->kgem);
-			if (!kgem_check_bo_fenced(&sna->kgem, bo))
+			if (!kgem_check_bo_fenced(&sna->kgem, bo)) {
+				/* let the fallback redraw the whole region */
+				kgem_bo_destroy(&sna->kgem, upload);
+				RegionTranslate(region, -dx, -dy);
 				return false;
+			}
 			_kgem_set_mode(&sna->kgem, KGEM_BLT);
 		}
 		kgem_bcs_set_tiling(&sna->kgem, NULL, bo);
 
-		upload = kgem_create_buffer(&sna->kgem,
-					    bstride*bh,
-					    KGEM_BUFFER_WRITE_INPLACE,
-					    &ptr);
-		if (!upload)
-			break;
-
-		if (sigtrap_get() == 0) {
-			uint8_t *dst = ptr;
-
-			int src_stride = bitmap->devKind;
-			uint8_t *src;
-			uint32_t *b;
-
-			assert(src_stride);
-			src = (uint8_t*)bitmap->devPrivate.ptr;
-			src += (box->y1 - region->extents.y1) * src_stride + bx1/8;
-			src_stride -= bstride;
-			do {
-				int i = bstride;
-				do {
-					*dst++ = byte_reverse(*src++);
-					*dst++ = byte_reverse(*src++);
-					i -= 2;
-				} while (i);
-				src += src_stride;
-			} while (--bh);
-
-			assert(sna->kgem.mode == KGEM_BLT);
-			b = sna->kgem.batch + sna->kgem.nbatch;
-			if (sna->kgem.gen >= 0100) {
-				b[0] = XY_MONO_SRC_COPY | 3 << 20 | 8;
-				b[0] |= ((box->x1 - region->extents.x1) & 7) << 17;
-				b[1] = bo->pitch;
-				if (sna->kgem.gen >= 040 && bo->tiling) {
-					b[0] |= BLT_DST_TILED;
-					b[1] >>= 2;
-				}
-				b[1] |= 1 << 29;
-				b[1] |= blt_depth(drawable->depth) << 24;
-				b[1] |= rop << 16;
-				b[2] = box->y1 << 16 | box->x1;
-				b[3] = box->y2 << 16 | box->x2;
-				*(uint64_t *)(b+4) =
-					kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 4, bo,
-							I915_GEM_DOMAIN_RENDER << 16 |
-							I915_GEM_DOMAIN_RENDER |
-							KGEM_RELOC_FENCED,
-							0);
-				*(uint64_t *)(b+6) =
-					kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 6, upload,
-							I915_GEM_DOMAIN_RENDER << 16 |
-							KGEM_RELOC_FENCED,
-							0);
-				b[8] = gc->bgPixel;
-				b[9] = gc->fgPixel;
-				sna->kgem.nbatch += 10;
-			} else {
-				b[0] = XY_MONO_SRC_COPY | 3 << 20 | 6;
-				b[0] |= ((box->x1 - region->extents.x1) & 7) << 17;
-				b[1] = bo->pitch;
-				if (sna->kgem.gen >= 040 && bo->tiling) {
-					b[0] |= BLT_DST_TILED;
-					b[1] >>= 2;
-				}
-				b[1] |= 1 << 29;
-				b[1] |= blt_depth(drawable->depth) << 24;
-				b[1] |= rop << 16;
-				b[2] = box->y1 << 16 | box->x1;
-				b[3] = box->y2 << 16 | box->x2;
-				b[4] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 4, bo,
+		assert(sna->kgem.mode == KGEM_BLT);
+		b = sna->kgem.batch + sna->kgem.nbatch;
+		if (sna->kgem.gen >= 0100) {
+			b[0] = XY_MONO_SRC_COPY | 3 << 20 | 8;
+			b[0] |= ((box->x1 - region->extents.x1) & 7) << 17;
+			b[1] = bo->pitch;
+			if (sna->kgem.gen >= 040 && bo->tiling) {
+				b[0] |= BLT_DST_TILED;
+				b[1] >>= 2;
+			}
+			b[1] |= 1 << 29;
+			b[1] |= blt_depth(drawable->depth) << 24;
+			b[1] |= rop << 16;
+			b[2] = box->y1 << 16 | box->x1;
+			b[3] = box->y2 << 16 | box->x2;
+			*(uint64_t *)(b+4) =
+				kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 4, bo,
 						I915_GEM_DOMAIN_RENDER << 16 |
 						I915_GEM_DOMAIN_RENDER |
 						KGEM_RELOC_FENCED,
 						0);
-				b[5] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 5, upload,
+			*(uint64_t *)(b+6) =
+				kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 6, upload,
 						I915_GEM_DOMAIN_RENDER << 16 |
 						KGEM_RELOC_FENCED,
-						0);
-				b[6] = gc->bgPixel;
-				b[7] = gc->fgPixel;
-
-				sna->kgem.nbatch += 8;
+						offset);
+			b[8] = gc->bgPixel;
+			b[9] = gc->fgPixel;
+			sna->kgem.nbatch += 10;
+		} else {
+			b[0] = XY_MONO_SRC_COPY | 3 << 20 | 6;
+			b[0] |= ((box->x1 - region->extents.x1) & 7) << 17;
+			b[1] = bo->pitch;
+			if (sna->kgem.gen >= 040 && bo->tiling) {
+				b[0] |= BLT_DST_TILED;
+				b[1] >>= 2;
 			}
-			sigtrap_put();
-		}
+			b[1] |= 1 << 29;
+			b[1] |= blt_depth(drawable->depth) << 24;
+			b[1] |= rop << 16;
+			b[2] = box->y1 << 16 | box->x1;
+			b[3] = box->y2 << 16 | box->x2;
+			b[4] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 4, bo,
+					I915_GEM_DOMAIN_RENDER << 16 |
+					I915_GEM_DOMAIN_RENDER |
+					KGEM_RELOC_FENCED,
+					0);
+			b[5] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 5, upload,
+					I915_GEM_DOMAIN_RENDER << 16 |
+					KGEM_RELOC_FENCED,
+					offset);
+			b[6] = gc->bgPixel;
+			b[7] = gc->fgPixel;
 
-		kgem_bo_destroy(&sna->kgem, upload);
+			sna->kgem.nbatch += 8;
+		}
 
+		offset += ALIGN(bstride * (box->y2 - box->y1), 8);
 		box++;
 	} while (--n);
 
+	kgem_bo_destroy(&sna->kgem, upload);
 	blt_done(sna);
 	return true;
 }
@@ -17135,6 +17565,110 @@ sna_get_image__blt(PixmapPtr pixmap,
 	return ok;
 }
 
+/*
+ * Read back through a linear staging buffer, a band at a time, and copy
+ * straight into the reply. Unlike migrating the region to the CPU, this
+ * neither allocates nor dirties the pixmap's shadow, so grabbing a large
+ * (and typically Y-tiled) scanout does not leave a CPU copy of it behind.
+ */
+static bool
+sna_get_image__download(PixmapPtr pixmap,
+			RegionPtr region,
+			char *dst,
+			unsigned flags)
+{
+	struct sna_pixmap *priv = sna_pixmap(pixmap);
+	struct sna *sna = to_sna_from_pixmap(pixmap);
+	int bpp = pixmap->drawable.bitsPerPixel;
+	int w = region->extents.x2 - region->extents.x1;
+	int h = region->extents.y2 - region->extents.y1;
+	int pitch = PixmapBytePad(w, pixmap->drawable.depth);
+	DrawableRec tmp;
+	BoxRec box;
+	int step;
+
+	if (!USE_STAGED_DOWNLOADS)
+		return false;
+
+	assert(priv && priv->gpu_bo);
+
+	if (wedged(sna))
+		return false;
+
+	if (w <= 0)
+		return false;
+
+	step = sna->kgem.max_upload_tile_size / (4 * w);
+	if (sna->render.max_3d_size && step > sna->render.max_3d_size)
+		step = sna->render.max_3d_size;
+	if (step > h)
+		step = h;
+	if (step == 0)
+		return false;
+
+	if (priv->move_to_gpu && !priv->move_to_gpu(sna, priv, MOVE_READ))
+		return false;
+
+	DBG(("%s: download (%d, %d), (%d, %d) in bands of %d rows\n",
+	     __FUNCTION__,
+	     region->extents.x1, region->extents.y1,
+	     region->extents.x2, region->extents.y2,
+	     step));
+
+	assert(sna_damage_contains_box(&priv->gpu_damage, &region->extents) == PIXMAN_REGION_IN);
+	assert(sna_damage_contains_box(&priv->cpu_damage, &region->extents) == PIXMAN_REGION_OUT);
+
+	tmp.width = w;
+	tmp.depth = pixmap->drawable.depth;
+	tmp.bitsPerPixel = bpp;
+
+	box.x1 = region->extents.x1;
+	box.x2 = region->extents.x2;
+	for (box.y1 = region->extents.y1; box.y1 < region->extents.y2; box.y1 = box.y2) {
+		struct kgem_bo *bo;
+		void *ptr;
+
+		box.y2 = box.y1 + step;
+		if (box.y2 > region->extents.y2)
+			box.y2 = region->extents.y2;
+		tmp.height = box.y2 - box.y1;
+
+		bo = kgem_create_buffer_2d(&sna->kgem,
+					   tmp.width, tmp.height, bpp,
+					   KGEM_BUFFER_LAST,
+					   &ptr);
+		if (bo == NULL)
+			return false;
+
+		if (!sna->render.copy_boxes(sna, GXcopy,
+					    &pixmap->drawable, priv->gpu_bo, 0, 0,
+					    &tmp, bo, -box.x1, -box.y1,
+					    &box, 1, COPY_LAST)) {
+			kgem_bo_destroy(&sna->kgem, bo);
+			return false;
+		}
+
+		kgem_bo_submit(&sna->kgem, bo);
+		kgem_buffer_read_sync(&sna->kgem, bo);
+
+		if (sigtrap_get()) {
+			kgem_bo_destroy(&sna->kgem, bo);
+			return false;
+		}
+
+		memcpy_blt(ptr, dst, bpp,
+			   bo->pitch, pitch,
+			   0, 0,
+			   0, box.y1 - region->extents.y1,
+			   tmp.width, tmp.height);
+		sigtrap_put();
+
+		kgem_bo_destroy(&sna->kgem, bo);
+	}
+
+	return true;
+}
+
 static bool
 sna_get_image__fast(PixmapPtr pixmap,
 		   RegionPtr region,
@@ -17192,6 +17726,9 @@ sna_get_image__fast(PixmapPtr pixmap,
 	if (sna_get_image__inplace(pixmap, region, dst, flags, false))
 		return true;
 
+	if (sna_get_image__download(pixmap, region, dst, flags))
+		return true;
+
 	return false;
 }
 
@@ -17212,6 +17749,8 @@ sna_get_image(DrawablePtr drawable,
 	     (long)get_drawable_pixmap(drawable)->drawable.serialNumber,
 	     x, y, w, h, format, mask, drawable->depth));
 
+	sna_pixmap_flush_deferred(sna_pixmap_from_drawable(drawable));
+
 	flags = MOVE_READ;
 	if ((w | h) == 1)
 		flags |= MOVE_INPLACE_HINT;
@@ -18117,6 +18656,7 @@ bool sna_accel_init(ScreenPtr screen, struct sna *sna)
 
 	list_init(&sna->flush_pixmaps);
 	list_init(&sna->active_pixmaps);
+	list_init(&sna->deferred_traps);
 
 	SetNotifyFd(sna->kgem.fd, sna_accel_notify, X_NOTIFY_READ, sna);
 
@@ -18327,6 +18867,8 @@ void sna_accel_close(struct sna *sna)
 {
 	DBG(("%s\n", __FUNCTION__));
 
+	sna_traps_flush(sna);
+	sna_traps_cache_fini(sna);
 	sna_composite_close(sna);
 	sna_gradients_close(sna);
 	sna_glyphs_close(sna);
@@ -18352,6 +18894,9 @@ void sna_accel_block(struct sna *sna, struct timeval **tv)
 	if (sna->timer_active)
 		UpdateCurrentTimeIf();
 
+	sna_traps_flush(sna);
+	sna_video_flush(sna);
+
 	if (sna->kgem.nbatch &&
 	    (sna->kgem.scanout_busy ||
 	     kgem_ring_is_idle(&sna->kgem, sna->kgem.ring))) {
@@ -669,6 +669,10 @@ sna_composite(CARD8 op,
 		return;
 	}
 
+	sna_picture_flush_deferred(src);
+	sna_picture_flush_deferred(mask);
+	sna_picture_flush_deferred(dst);
+
 	if (op == PictOpClear) {
 		DBG(("%s: discarding source and mask for clear\n", __FUNCTION__));
 		mask = NULL;
@@ -820,6 +824,8 @@ sna_composite_rectangles(CARD8		 op,
 		return;
 	}
 
+	sna_picture_flush_deferred(dst);
+
 	if (color->alpha <= 0x00ff) {
 		if (PICT_FORMAT_TYPE(dst->format) == PICT_TYPE_A ||
 		    (color->red|color->green|color->blue) <= 0x00ff) {
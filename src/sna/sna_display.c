@@ -40,6 +40,10 @@
 #include <poll.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <time.h>
+#if HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
 
 #if HAVE_ALLOCA_H
 #include <alloca.h>
@@ -92,6 +96,7 @@ void *alloca(size_t);
 #endif
 
 #define FAIL_CURSOR_IOCTL 0
+#define NO_LATE_LATCH 0
 
 #define COLDPLUG_DELAY_MS 2000
 
@@ -189,8 +194,20 @@ struct sna_cursor {
 	unsigned handle;
 	unsigned serial;
 	unsigned alloc;
+
+	/* cache key for the prepared image */
+	uint64_t hash;
+	uint32_t fg, bg;
+	struct pixman_f_transform transform;
 };
 
+/* Prepared cursor images are kept (most recently used first) on
+ * sna->cursor.cursors so that cursors cycling through a set of frames
+ * do not need to be regenerated and uploaded every time.
+ */
+#define CURSOR_CACHE_SIZE 32
+#define CURSOR_CACHE_BYTES (4 << 20)
+
 struct sna_crtc {
 	unsigned long flags;
 	uint32_t id;
@@ -198,7 +215,7 @@ struct sna_crtc {
 	struct drm_mode_modeinfo kmode;
 	PixmapPtr slave_pixmap;
 	DamagePtr slave_damage;
-	struct kgem_bo *bo, *shadow_bo, *client_bo, *cache_bo;
+	struct kgem_bo *bo, *shadow_bo, *client_bo;
 	struct sna_cursor *cursor;
 	unsigned int last_cursor_size;
 	uint32_t offset;
@@ -211,9 +228,20 @@ struct sna_crtc {
 
 	struct pict_f_transform cursor_to_fb, fb_to_cursor;
 
-	RegionRec crtc_damage;
 	uint16_t shadow_bo_width, shadow_bo_height;
 
+	/* TearFree swapchain for transformed outputs: the idle buffers,
+	 * tagged with the frame they were last rendered for, and the damage
+	 * introduced by each of the last SHADOW_MAX_BUFFERS frames.
+	 */
+	struct {
+		struct kgem_bo *bo;
+		unsigned frame;
+	} shadow_swap[SHADOW_MAX_BUFFERS];
+	int shadow_swap_count;
+	unsigned frame, bo_frame;
+	RegionRec damage_history[SHADOW_MAX_BUFFERS];
+
 	uint32_t rotation;
 	struct plane {
 		uint32_t id;
@@ -313,6 +341,7 @@ enum { /* XXX copied from hw/xfree86/modes/xf86Crtc.c */
 
 static void __sna_output_dpms(xf86OutputPtr output, int dpms, int fixup);
 static void sna_crtc_disable_cursor(struct sna *sna, struct sna_crtc *crtc);
+static void sna_mode_latch_close(struct sna *sna);
 static bool sna_crtc_flip(struct sna *sna, struct sna_crtc *crtc,
 			  struct kgem_bo *bo, int x, int y);
 
@@ -2132,6 +2161,23 @@ static void sna_crtc_disable_shadow(struct sna *sna, struct sna_crtc *crtc)
 	crtc->shadow = false;
 }
 
+static void
+shadow_swap_reset(struct sna *sna, struct sna_crtc *sna_crtc)
+{
+	int n;
+
+	DBG(("%s: CRTC:%d discarding %d idle buffers\n",
+	     __FUNCTION__, __sna_crtc_id(sna_crtc), sna_crtc->shadow_swap_count));
+
+	for (n = 0; n < sna_crtc->shadow_swap_count; n++)
+		kgem_bo_destroy(&sna->kgem, sna_crtc->shadow_swap[n].bo);
+	sna_crtc->shadow_swap_count = 0;
+
+	for (n = 0; n < SHADOW_MAX_BUFFERS; n++)
+		RegionEmpty(&sna_crtc->damage_history[n]);
+	sna_crtc->bo_frame = 0;
+}
+
 static void
 __sna_crtc_disable(struct sna *sna, struct sna_crtc *sna_crtc)
 {
@@ -2167,6 +2213,7 @@ __sna_crtc_disable(struct sna *sna, struct sna_crtc *sna_crtc)
 		kgem_bo_destroy(&sna->kgem, sna_crtc->shadow_bo);
 		sna_crtc->shadow_bo = NULL;
 	}
+	shadow_swap_reset(sna, sna_crtc);
 	if (sna_crtc->transform) {
 		assert(sna->mode.rr_active);
 		sna->mode.rr_active--;
@@ -2965,7 +3012,7 @@ sna_crtc_damage(xf86CrtcPtr crtc)
 	assert(sna->mode.shadow_damage && sna->mode.shadow_active);
 	damage = DamageRegion(sna->mode.shadow_damage);
 	RegionUnion(damage, damage, &region);
-	to_sna_crtc(crtc)->crtc_damage = region;
+	shadow_swap_reset(sna, to_sna_crtc(crtc));
 
 	DBG(("%s: damage now %dx[(%d, %d), (%d, %d)]\n",
 	     __FUNCTION__,
@@ -3230,6 +3277,7 @@ sna_crtc_destroy(xf86CrtcPtr crtc)
 {
 	struct sna_crtc *sna_crtc = to_sna_crtc(crtc);
 	struct plane *sprite, *sn;
+	int n;
 
 	if (sna_crtc == NULL)
 		return;
@@ -3237,6 +3285,9 @@ sna_crtc_destroy(xf86CrtcPtr crtc)
 	list_for_each_entry_safe(sprite, sn, &sna_crtc->sprites, link)
 		free(sprite);
 
+	for (n = 0; n < SHADOW_MAX_BUFFERS; n++)
+		RegionUninit(&sna_crtc->damage_history[n]);
+
 	free(sna_crtc);
 	crtc->driver_private = NULL;
 }
@@ -3509,6 +3560,7 @@ sna_crtc_add(ScrnInfoPtr scrn, unsigned id)
 	xf86CrtcPtr crtc;
 	struct sna_crtc *sna_crtc;
 	struct drm_i915_get_pipe_from_crtc_id get_pipe;
+	int n;
 
 	DBG(("%s(%d): is-zaphod? %d\n", __FUNCTION__, id, is_zaphod(scrn)));
 
@@ -3545,6 +3597,8 @@ sna_crtc_add(ScrnInfoPtr scrn, unsigned id)
 	     sna_crtc->primary.id, sna_crtc->primary.rotation.supported, sna_crtc->primary.rotation.current));
 
 	list_init(&sna_crtc->shadow_link);
+	for (n = 0; n < SHADOW_MAX_BUFFERS; n++)
+		RegionNull(&sna_crtc->damage_history[n]);
 
 	crtc = xf86CrtcCreate(scrn, &sna_crtc_funcs);
 	if (crtc == NULL) {
@@ -5808,22 +5862,66 @@ rotate_coord(Rotation rotation, int size,
 	*y_src = y_dst;
 }
 
+static void __sna_free_cursor(struct sna *sna, struct sna_cursor *cursor)
+{
+	assert(cursor->ref == 0);
+
+	if (cursor->image)
+		munmap(cursor->image, cursor->alloc);
+	gem_close(sna->kgem.fd, cursor->handle);
+
+	cursor->next = sna->cursor.stash;
+	sna->cursor.stash = cursor;
+	sna->cursor.num_stash++;
+}
+
 static struct sna_cursor *__sna_create_cursor(struct sna *sna, int size)
 {
-	struct sna_cursor *c;
+	struct sna_cursor *c, **prev, **lru = NULL, **victim = NULL;
+	unsigned bytes = 0;
+	int count = 0;
 
-	for (c = sna->cursor.cursors; c; c = c->next) {
-		if (c->ref == 0 && c->alloc >= size) {
-			__DBG(("%s: stealing handle=%d, serial=%d, rotation=%d, alloc=%d\n",
-			       __FUNCTION__, c->handle, c->serial, c->rotation, c->alloc));
-			return c;
-		}
+	for (prev = &sna->cursor.cursors; (c = *prev); prev = &c->next) {
+		bytes += c->alloc;
+		if (c->ref)
+			continue;
+
+		count++;
+		victim = prev;
+		if (c->alloc >= size)
+			lru = prev;
+	}
+
+	/* Without shared GTT cursors, there is no cache to preserve */
+	if (lru &&
+	    (!sna->cursor.use_gtt ||
+	     sna->cursor.stash == NULL ||
+	     count >= CURSOR_CACHE_SIZE ||
+	     bytes + size > CURSOR_CACHE_BYTES)) {
+		c = *lru;
+		__DBG(("%s: stealing handle=%d, serial=%d, rotation=%d, alloc=%d\n",
+		       __FUNCTION__, c->handle, c->serial, c->rotation, c->alloc));
+		c->serial = 0;
+		c->hash = 0;
+		return c;
+	}
+
+	if (victim &&
+	    (sna->cursor.stash == NULL ||
+	     count >= CURSOR_CACHE_SIZE ||
+	     bytes + size > CURSOR_CACHE_BYTES)) {
+		c = *victim;
+		__DBG(("%s: evicting handle=%d, alloc=%d\n",
+		       __FUNCTION__, c->handle, c->alloc));
+		*victim = c->next;
+		__sna_free_cursor(sna, c);
 	}
 
 	__DBG(("%s(size=%d, num_stash=%d)\n", __FUNCTION__, size, sna->cursor.num_stash));
 
 	c = sna->cursor.stash;
-	assert(c);
+	if (c == NULL)
+		return NULL;
 
 	c->alloc = ALIGN(size, 4096);
 	c->handle = gem_create(sna->kgem.fd, c->alloc);
@@ -5846,6 +5944,7 @@ static struct sna_cursor *__sna_create_cursor(struct sna *sna, int size)
 
 	c->ref = 0;
 	c->serial = 0;
+	c->hash = 0;
 	c->rotation = 0;
 	c->last_width = c->last_height = 0; /* all clear */
 	c->size = size;
@@ -5879,6 +5978,78 @@ static int __cursor_size(int width, int height)
 	return size;
 }
 
+static uint64_t cursor_hash(CursorPtr cursor)
+{
+	const uint32_t *argb = get_cursor_argb(cursor);
+	const uint32_t *data;
+	uint64_t hash;
+	int n;
+
+	/* FNV-1a over 32-bit words */
+	hash = 0xcbf29ce484222325ull;
+	hash = (hash ^ (cursor->bits->width << 16 | cursor->bits->height)) * 0x100000001b3ull;
+	hash = (hash ^ (argb != NULL)) * 0x100000001b3ull;
+
+	if (argb) {
+		data = argb;
+		n = cursor->bits->width * cursor->bits->height;
+	} else {
+		/* scanlines are padded to 32 bits */
+		n = BitmapBytePad(cursor->bits->width) * cursor->bits->height / 4;
+		for (data = (const uint32_t *)cursor->bits->source; n--; data++)
+			hash = (hash ^ *data) * 0x100000001b3ull;
+
+		data = (const uint32_t *)cursor->bits->mask;
+		n = BitmapBytePad(cursor->bits->width) * cursor->bits->height / 4;
+	}
+	while (n--)
+		hash = (hash ^ *data++) * 0x100000001b3ull;
+
+	return hash ?: 1;
+}
+
+static bool cursor_matches(struct sna *sna, struct sna_cursor *cursor,
+			   xf86CrtcPtr crtc, int size,
+			   Rotation rotation, bool transformed)
+{
+	if (cursor->hash != sna->cursor.hash)
+		return false;
+
+	if (cursor->rotation != rotation || cursor->transformed != transformed)
+		return false;
+
+	if (!get_cursor_argb(sna->cursor.ref) &&
+	    (cursor->fg != sna->cursor.fg || cursor->bg != sna->cursor.bg))
+		return false;
+
+	if (transformed) {
+		if (cursor->size != size)
+			return false;
+
+		if (memcmp(&cursor->transform,
+			   &to_sna_crtc(crtc)->cursor_to_fb,
+			   sizeof(cursor->transform)))
+			return false;
+	} else {
+		if (cursor->size != sna->cursor.size)
+			return false;
+	}
+
+	return true;
+}
+
+static void cursor_mark_used(struct sna *sna, struct sna_cursor *cursor)
+{
+	struct sna_cursor **prev;
+
+	for (prev = &sna->cursor.cursors; *prev != cursor; prev = &(*prev)->next)
+		assert(*prev);
+
+	*prev = cursor->next;
+	cursor->next = sna->cursor.cursors;
+	sna->cursor.cursors = cursor;
+}
+
 static struct sna_cursor *__sna_get_cursor(struct sna *sna, xf86CrtcPtr crtc)
 {
 	struct sna_cursor *cursor;
@@ -5972,22 +6143,25 @@ static struct sna_cursor *__sna_get_cursor(struct sna *sna, xf86CrtcPtr crtc)
 	}
 
 	/* Don't allow phys cursor sharing */
-	if (sna->cursor.use_gtt && !transformed) {
+	if (sna->cursor.use_gtt) {
 		for (cursor = sna->cursor.cursors; cursor; cursor = cursor->next) {
-			if (cursor->serial == sna->cursor.serial &&
-			    cursor->rotation == rotation &&
-			    !cursor->transformed) {
+			if (cursor_matches(sna, cursor, crtc, size,
+					   rotation, transformed)) {
 				__DBG(("%s: reusing handle=%d, serial=%d, rotation=%d, size=%d\n",
 				       __FUNCTION__, cursor->handle, cursor->serial, cursor->rotation, cursor->size));
-				assert(cursor->size == sna->cursor.size);
+				cursor->serial = sna->cursor.serial;
+				cursor_mark_used(sna, cursor);
 				return cursor;
 			}
 		}
-	}
 
-	cursor = to_sna_crtc(crtc)->cursor;
-	if (cursor && cursor->alloc < 4*size*size)
+		/* Keep the current image cached, and prepare a new one */
 		cursor = NULL;
+	} else {
+		cursor = to_sna_crtc(crtc)->cursor;
+		if (cursor && cursor->alloc < 4*size*size)
+			cursor = NULL;
+	}
 
 	if (cursor == NULL) {
 		cursor = __sna_create_cursor(sna, 4*size*size);
@@ -6099,7 +6273,11 @@ static struct sna_cursor *__sna_get_cursor(struct sna *sna, xf86CrtcPtr crtc)
 	cursor->rotation = rotation;
 	cursor->transformed = transformed;
 	cursor->serial = sna->cursor.serial;
+	cursor->hash = sna->cursor.hash;
+	cursor->fg = sna->cursor.fg;
+	cursor->bg = sna->cursor.bg;
 	if (transformed) {
+		cursor->transform = to_sna_crtc(crtc)->cursor_to_fb;
 		/* mark the transformed rectangle as dirty, not input */
 		cursor->last_width = size;
 		cursor->last_height = size;
@@ -6107,6 +6285,7 @@ static struct sna_cursor *__sna_get_cursor(struct sna *sna, xf86CrtcPtr crtc)
 		cursor->last_width = width;
 		cursor->last_height = height;
 	}
+	cursor_mark_used(sna, cursor);
 	return cursor;
 }
 
@@ -6316,19 +6495,15 @@ sna_hide_cursors(ScrnInfoPtr scrn)
 	for (prev = &sna->cursor.cursors; (cursor = *prev) != NULL; ) {
 		assert(cursor->ref == 0);
 
-		if (cursor->serial == sna->cursor.serial) {
+		/* Keep the cache of prepared images, unless closing */
+		if (cursor->serial == sna->cursor.serial ||
+		    (sna->cursor.serial && sna->cursor.use_gtt && cursor->hash)) {
 			prev = &cursor->next;
 			continue;
 		}
 
 		*prev = cursor->next;
-		if (cursor->image)
-			munmap(cursor->image, cursor->alloc);
-		gem_close(sna->kgem.fd, cursor->handle);
-
-		cursor->next = sna->cursor.stash;
-		sna->cursor.stash = cursor;
-		sna->cursor.num_stash++;
+		__sna_free_cursor(sna, cursor);
 	}
 
 	sigio_unblock(sigio);
@@ -6586,6 +6761,7 @@ sna_use_hw_cursor(ScreenPtr screen, CursorPtr cursor)
 	sna->cursor.ref = cursor;
 	cursor->refcnt++;
 	sna->cursor.serial++;
+	sna->cursor.hash = cursor_hash(cursor);
 
 	DBG(("%s(%dx%d): ARGB?=%d, serial->%d, size->%d\n", __FUNCTION__,
 	       cursor->bits->width,
@@ -6649,6 +6825,8 @@ sna_cursor_pre_init(struct sna *sna)
 		sna->cursor.max_size = 0;
 
 	sna->cursor.num_stash = -sna->mode.num_real_crtc;
+	if (sna->cursor.use_gtt)
+		sna->cursor.num_stash -= CURSOR_CACHE_SIZE;
 
 	xf86DrvMsg(sna->scrn->scrnIndex, X_PROBED,
 		   "Using a maximum size of %dx%d for hardware cursors\n",
@@ -6668,6 +6846,8 @@ sna_cursor_close(struct sna *sna)
 	}
 
 	sna->cursor.num_stash = -sna->mode.num_real_crtc;
+	if (sna->cursor.use_gtt)
+		sna->cursor.num_stash -= CURSOR_CACHE_SIZE;
 }
 
 bool
@@ -7500,6 +7680,8 @@ bool sna_mode_pre_init(ScrnInfoPtr scrn, struct sna *sna)
 	int num_fake = 0;
 	int i;
 
+	sna->mode.latch.fd = -1;
+
 	if (sna->flags & SNA_IS_HOSTED) {
 		sna_setup_provider(scrn);
 		return true;
@@ -7770,6 +7952,7 @@ sna_mode_close(struct sna *sna)
 	sna_cursors_fini(sna);
 
 	sna_backlight_close(sna);
+	sna_mode_latch_close(sna);
 	sna->mode.dirty = false;
 }
 
@@ -8482,6 +8665,172 @@ inline static DrawablePtr crtc_source(xf86CrtcPtr crtc, int16_t *sx, int16_t *sy
 	}
 }
 
+#define NO_ROTATE_BLT 0
+
+struct rotate_redisplay {
+	const void *src;
+	void *dst;
+	int bpp;
+	int32_t src_stride, dst_stride;
+	int src_width, src_height;
+	BoxRec box;
+	int m[6];
+};
+
+/* Recognise the 8 axis-aligned orientations (RR_Rotate_* and their
+ * reflections) with an integer offset, which we can copy directly.
+ */
+static bool transform_is_orthogonal(const PictTransform *t, int m[6])
+{
+	int i;
+
+	if (t->matrix[2][0] || t->matrix[2][1] ||
+	    t->matrix[2][2] != pixman_fixed_1)
+		return false;
+
+	for (i = 0; i < 2; i++) {
+		pixman_fixed_t a = t->matrix[i][0];
+		pixman_fixed_t b = t->matrix[i][1];
+
+		if (pixman_fixed_frac(t->matrix[i][2]))
+			return false;
+
+		if (!((a == 0 && (b == pixman_fixed_1 || b == -pixman_fixed_1)) ||
+		      (b == 0 && (a == pixman_fixed_1 || a == -pixman_fixed_1))))
+			return false;
+
+		m[3*i + 0] = pixman_fixed_to_int(a);
+		m[3*i + 1] = pixman_fixed_to_int(b);
+		/* sample at the centre of the destination pixel */
+		m[3*i + 2] = pixman_fixed_to_int(t->matrix[i][2]) - (a + b < 0);
+	}
+
+	return m[0] * m[4] - m[1] * m[3] != 0;
+}
+
+static void rotate_redisplay_band(void *arg, int y, int height)
+{
+	const struct rotate_redisplay *r = arg;
+	int dx = r->box.x1, dy = r->box.y1 + y;
+
+	rotate_blt(r->src, r->dst, r->bpp,
+		   r->src_stride, r->dst_stride,
+		   r->m[0] * dx + r->m[1] * dy + r->m[2],
+		   r->m[3] * dx + r->m[4] * dy + r->m[5],
+		   dx, dy,
+		   r->box.x2 - r->box.x1, height,
+		   r->m[0], r->m[1], r->m[3], r->m[4]);
+}
+
+static bool rotate_redisplay_in_bounds(const struct rotate_redisplay *r,
+				       const BoxRec *box)
+{
+	int x[2] = { box->x1, box->x2 - 1 };
+	int y[2] = { box->y1, box->y2 - 1 };
+	int i, j;
+
+	/* Every corner must sample from inside the source */
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < 2; i++) {
+			int sx = r->m[0] * x[i] + r->m[1] * y[j] + r->m[2];
+			int sy = r->m[3] * x[i] + r->m[4] * y[j] + r->m[5];
+			if (sx < 0 || sx >= r->src_width ||
+			    sy < 0 || sy >= r->src_height)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/* Fast path for pure rotations and reflections on the CPU: a tile-blocked
+ * copy split across the threads, instead of a general pixman transform.
+ * Returns false if the transform is not suitable, in which case nothing
+ * has been written.
+ */
+static bool
+sna_crtc_redisplay__rotate(xf86CrtcPtr crtc, RegionPtr region,
+			   DrawablePtr draw, const PictTransform *T,
+			   struct kgem_bo *bo, void *ptr)
+{
+	struct sna *sna = to_sna(crtc->scrn);
+	PixmapPtr pixmap = get_drawable_pixmap(draw);
+	struct rotate_redisplay r;
+	const BoxRec *b;
+	int n;
+
+	if (NO_ROTATE_BLT)
+		return false;
+
+	if (draw->bitsPerPixel != 8 &&
+	    draw->bitsPerPixel != 16 &&
+	    draw->bitsPerPixel != 32)
+		return false;
+
+	if (crtc->filter && crtc->transform_in_use &&
+	    crtc->filter->id != PictFilterNearest &&
+	    crtc->filter->id != PictFilterBilinear &&
+	    crtc->filter->id != PictFilterFast &&
+	    crtc->filter->id != PictFilterGood)
+		return false;
+
+	if (!transform_is_orthogonal(T, r.m))
+		return false;
+
+	if (pixmap->devPrivate.ptr == NULL)
+		return false;
+
+	DBG(("%s: orthogonal transform [%d %d %d; %d %d %d]\n",
+	     __FUNCTION__, r.m[0], r.m[1], r.m[2], r.m[3], r.m[4], r.m[5]));
+
+	r.src = pixmap->devPrivate.ptr;
+	r.src_stride = pixmap->devKind;
+	r.src_width = pixmap->drawable.width;
+	r.src_height = pixmap->drawable.height;
+	r.dst = ptr;
+	r.dst_stride = bo->pitch;
+	r.bpp = draw->bitsPerPixel;
+
+	b = region_rects(region);
+	n = region_num_rects(region);
+	do {
+		BoxRec box = *b++;
+
+		transformed_box(&box, crtc);
+		if (!box_empty(&box) && !rotate_redisplay_in_bounds(&r, &box)) {
+			DBG(("%s: source out of bounds for (%d, %d), (%d, %d)\n",
+			     __FUNCTION__, box.x1, box.y1, box.x2, box.y2));
+			return false;
+		}
+	} while (--n);
+
+	kgem_bo_sync__gtt(&sna->kgem, bo);
+
+	b = region_rects(region);
+	n = region_num_rects(region);
+	do {
+		r.box = *b++;
+		transformed_box(&r.box, crtc);
+		if (box_empty(&r.box))
+			continue;
+
+		DBG(("%s: (%d, %d), (%d, %d)\n", __FUNCTION__,
+		     r.box.x1, r.box.y1, r.box.x2, r.box.y2));
+
+		if (sna_threads_bands(r.box.x2 - r.box.x1,
+				      r.box.y2 - r.box.y1, 32,
+				      rotate_redisplay_band, &r))
+			continue;
+
+		if (sigtrap_get() == 0) { /* paranoia */
+			rotate_redisplay_band(&r, 0, r.box.y2 - r.box.y1);
+			sigtrap_put();
+		}
+	} while (--n);
+
+	return true;
+}
+
 static void
 sna_crtc_redisplay__fallback(xf86CrtcPtr crtc, RegionPtr region, struct kgem_bo *bo)
 {
@@ -8523,6 +8872,11 @@ sna_crtc_redisplay__fallback(xf86CrtcPtr crtc, RegionPtr region, struct kgem_bo
 	if (ptr == NULL)
 		return;
 
+	pixman_transform_init_translate(&T, sx << 16, sy << 16);
+	pixman_transform_multiply(&T, &T, &crtc->crtc_to_framebuffer);
+	if (sna_crtc_redisplay__rotate(crtc, region, draw, &T, bo, ptr))
+		return;
+
 	pixmap = sna_pixmap_create_unattached(screen, 0, 0, depth);
 	if (pixmap == NullPixmap)
 		return;
@@ -8538,8 +8892,6 @@ sna_crtc_redisplay__fallback(xf86CrtcPtr crtc, RegionPtr region, struct kgem_bo
 	if (!src)
 		goto free_pixmap;
 
-	pixman_transform_init_translate(&T, sx << 16, sy << 16);
-	pixman_transform_multiply(&T, &T, &crtc->crtc_to_framebuffer);
 	if (!sna_transform_is_integer_translation(&T, &sx, &sy)) {
 #define f2d(x) (((double)(x))/65536.)
 		DBG(("%s: transform=[[%f %f %f], [%f %f %f], [%f %f %f]] (raw [[%x %x %x], [%x %x %x], [%x %x %x]])\n",
@@ -8786,11 +9138,246 @@ sna_crtc_redisplay(xf86CrtcPtr crtc, RegionPtr region, struct kgem_bo *bo)
 		sna_crtc_redisplay__fallback(crtc, region, bo);
 }
 
+/* Late latching of the TearFree redisplay.
+ *
+ * Rather than copying the shadow damage and queueing the next flip as
+ * soon as the previous flip completes (which then sits idle for most of
+ * the frame and so displays content that is a frame old), we predict
+ * how long the redisplay takes and delay it until just before the next
+ * vblank. The prediction is the running average of the time taken to
+ * construct and submit the redisplay plus a safety margin, which grows
+ * whenever the flip misses its intended vblank and slowly decays again
+ * whilst we keep hitting it. Present copies land in the front buffer
+ * and so are caught by the same late redisplay.
+ */
+#define LATCH_MIN_MARGIN 500 /* us */
+#define LATCH_MIN_SLEEP 250 /* us */
+#define LATCH_MAX_IDLE 1000000 /* us, before the last swap is too stale */
+
+static uint64_t latch_now(void)
+{
+	struct timespec tv;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &tv))
+		return 0;
+
+	return ust64(tv.tv_sec, tv.tv_nsec / 1000);
+}
+
+static int crtc_frame_us(xf86CrtcPtr crtc)
+{
+	const DisplayModeRec *mode = &crtc->mode;
+
+	if (mode->Clock <= 0 || mode->HTotal <= 0 || mode->VTotal <= 0)
+		return 0;
+
+	/* Clock is in kHz */
+	return (int64_t)mode->HTotal * mode->VTotal * 1000 / mode->Clock;
+}
+
+#if HAVE_NOTIFY_FD
+static void latch_notify(int fd, int ready, void *data)
+{
+	_sna_mode_latch_wakeup(data);
+}
+#endif
+
+static bool latch_open(struct sna *sna)
+{
+	assert(sna->mode.latch.fd == -1);
+
+#if HAVE_SYS_TIMERFD_H
+	sna->mode.latch.fd = timerfd_create(CLOCK_MONOTONIC,
+					    TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+	DBG(("%s: fd=%d\n", __FUNCTION__, sna->mode.latch.fd));
+	if (sna->mode.latch.fd < 0) {
+		/* Do not try again */
+		sna->mode.latch.fd = -2;
+		return false;
+	}
+
+	sna->mode.latch.armed = false;
+	sna->mode.latch.flip = false;
+	sna->mode.latch.cost = 1000;
+	sna->mode.latch.margin = 2000;
+
+	SetNotifyFd(sna->mode.latch.fd, latch_notify, X_NOTIFY_READ, sna);
+	return true;
+}
+
+static void sna_mode_latch_close(struct sna *sna)
+{
+	if (sna->mode.latch.fd >= 0) {
+		RemoveNotifyFd(sna->mode.latch.fd);
+		close(sna->mode.latch.fd);
+	}
+	sna->mode.latch.fd = -1;
+	sna->mode.latch.armed = false;
+	sna->mode.latch.flip = false;
+}
+
+static bool latch_arm(struct sna *sna, uint64_t deadline)
+{
+#if HAVE_SYS_TIMERFD_H
+	struct itimerspec it;
+
+	memset(&it, 0, sizeof(it));
+	it.it_value.tv_sec = deadline / 1000000;
+	it.it_value.tv_nsec = deadline % 1000000 * 1000;
+	if (timerfd_settime(sna->mode.latch.fd, TFD_TIMER_ABSTIME, &it, NULL) == 0) {
+		sna->mode.latch.armed = true;
+		return true;
+	}
+#endif
+	return false;
+}
+
+/* Find the latest point at which we can start the redisplay and still
+ * make the next vblank on every active pipe.
+ */
+static uint64_t latch_deadline(struct sna *sna, uint64_t now)
+{
+	xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(sna->scrn);
+	uint64_t deadline = 0;
+	int cost = sna->mode.latch.cost + sna->mode.latch.margin;
+	int i;
+
+	for (i = 0; i < sna->mode.num_real_crtc; i++) {
+		xf86CrtcPtr crtc = config->crtc[i];
+		struct sna_crtc *sna_crtc = to_sna_crtc(crtc);
+		uint64_t last, next;
+		int frame;
+
+		assert(sna_crtc != NULL);
+		if (sna_crtc->bo == NULL)
+			continue;
+
+		frame = crtc_frame_us(crtc);
+		last = swap_ust(&sna_crtc->swap);
+		if (frame == 0 || cost >= frame ||
+		    last == 0 || last > now || now - last > LATCH_MAX_IDLE) {
+			DBG(("%s: no usable timing for pipe=%d (frame=%d, last=%lld, cost=%d)\n",
+			     __FUNCTION__, __sna_crtc_pipe(sna_crtc), frame, (long long)last, cost));
+			return 0;
+		}
+
+		next = last + ((now + cost - last) / frame + 1) * frame;
+		assert(next - cost > now);
+		if (deadline == 0 || next - cost < deadline) {
+			deadline = next - cost;
+			sna->mode.latch.target = next;
+			sna->mode.latch.frame = frame;
+		}
+	}
+
+	return deadline;
+}
+
+static void latch_feedback(struct sna *sna, uint64_t ust)
+{
+	struct sna_mode *mode = &sna->mode;
+
+	mode->latch.flip = false;
+
+	if (ust > mode->latch.target + mode->latch.frame / 2) {
+		mode->latch.margin *= 2;
+		if (mode->latch.margin > mode->latch.frame / 2)
+			mode->latch.margin = mode->latch.frame / 2;
+		DBG(("%s: missed target vblank by %lldus, margin now %dus\n",
+		     __FUNCTION__, (long long)(ust - mode->latch.target),
+		     mode->latch.margin));
+	} else {
+		mode->latch.margin -= mode->latch.margin >> 4;
+		if (mode->latch.margin < LATCH_MIN_MARGIN)
+			mode->latch.margin = LATCH_MIN_MARGIN;
+	}
+}
+
+static bool latch_defer(struct sna *sna)
+{
+	uint64_t now, deadline;
+
+	if (NO_LATE_LATCH)
+		return false;
+
+	if ((sna->flags & SNA_TEAR_FREE) == 0)
+		return false;
+
+	if (sna->mode.latch.armed)
+		return true;
+
+	if (!sna->mode.shadow_enabled || sna->mode.hidden || sna->mode.dirty)
+		return false;
+
+	assert(sna->mode.shadow_damage);
+	if (RegionNil(DamageRegion(sna->mode.shadow_damage)))
+		return false;
+
+	if (sna->mode.latch.fd == -1)
+		latch_open(sna);
+	if (sna->mode.latch.fd < 0)
+		return false;
+
+	/* The flip completion will reschedule us */
+	if (sna->mode.flip_active)
+		return true;
+
+	now = latch_now();
+	deadline = latch_deadline(sna, now);
+	if (deadline == 0 || deadline < now + LATCH_MIN_SLEEP)
+		return false;
+
+	DBG(("%s: delaying redisplay by %lldus, target vblank in %lldus\n",
+	     __FUNCTION__, (long long)(deadline - now),
+	     (long long)(sna->mode.latch.target - now)));
+	return latch_arm(sna, deadline);
+}
+
+static void __sna_mode_redisplay(struct sna *sna);
+
+static void latch_redisplay(struct sna *sna)
+{
+	uint64_t start, end;
+
+	start = latch_now();
+	__sna_mode_redisplay(sna);
+	end = latch_now();
+
+	if (end > start) {
+		int cost = end - start;
+		sna->mode.latch.cost = (7 * sna->mode.latch.cost + cost) / 8;
+	}
+
+	sna->mode.latch.flip = sna->mode.flip_active != 0;
+}
+
+void _sna_mode_latch_wakeup(struct sna *sna)
+{
+	uint64_t expirations;
+
+	if (read(sna->mode.latch.fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	DBG(("%s: armed? %d\n", __FUNCTION__, sna->mode.latch.armed));
+	if (!sna->mode.latch.armed)
+		return;
+
+	sna->mode.latch.armed = false;
+	if (!sna->scrn->vtSema)
+		return;
+
+	latch_redisplay(sna);
+}
+
 static void shadow_flip_handler(struct drm_event_vblank *e,
 				void *data)
 {
 	struct sna *sna = data;
 
+	if (sna->mode.latch.flip)
+		latch_feedback(sna, ust64(e->tv_sec, e->tv_usec));
+
 	if (!sna->mode.shadow_wait)
 		sna_mode_redisplay(sna);
 }
@@ -8918,7 +9505,102 @@ static bool move_crtc_to_gpu(struct sna *sna)
 	return true;
 }
 
-void sna_mode_redisplay(struct sna *sna)
+static unsigned
+shadow_swap_begin(struct sna_crtc *sna_crtc, RegionPtr damage)
+{
+	unsigned frame;
+
+	if (++sna_crtc->frame == 0)
+		sna_crtc->frame = 1;
+	frame = sna_crtc->frame;
+
+	RegionCopy(&sna_crtc->damage_history[frame % SHADOW_MAX_BUFFERS],
+		   damage);
+	return frame;
+}
+
+/* Extend the damage for the current frame to everything that changed
+ * since the buffer was last rendered, or the whole CRTC if that is
+ * older than our damage history.
+ */
+static void
+shadow_swap_damage(struct sna_crtc *sna_crtc, RegionPtr damage,
+		   unsigned since)
+{
+	unsigned age = sna_crtc->frame - since;
+
+	DBG(("%s: CRTC:%d frame=%d, buffer age=%d\n",
+	     __FUNCTION__, __sna_crtc_id(sna_crtc), sna_crtc->frame,
+	     since ? age : 0));
+
+	if (since == 0 || age > SHADOW_MAX_BUFFERS) {
+		RegionUninit(damage);
+		damage->extents = sna_crtc->base->bounds;
+		damage->data = NULL;
+		return;
+	}
+
+	while (--age)
+		RegionUnion(damage, damage,
+			    &sna_crtc->damage_history[(since + age) % SHADOW_MAX_BUFFERS]);
+}
+
+static struct kgem_bo *
+shadow_swap_get(struct sna *sna, struct sna_crtc *sna_crtc, RegionPtr damage)
+{
+	xf86CrtcPtr crtc = sna_crtc->base;
+	struct kgem_bo *bo = NULL;
+	unsigned since = 0;
+	int n, oldest;
+
+	/* Grow the chain until it is full, then rotate through the buffers
+	 * in the order they were shown.
+	 */
+	if (sna_crtc->shadow_swap_count + 1 < sna->mode.shadow_buffers)
+		bo = kgem_create_2d(&sna->kgem,
+				    crtc->mode.HDisplay,
+				    crtc->mode.VDisplay,
+				    crtc->scrn->bitsPerPixel,
+				    sna_crtc->bo->tiling,
+				    CREATE_SCANOUT);
+	if (bo == NULL) {
+		if (sna_crtc->shadow_swap_count == 0)
+			return NULL;
+
+		oldest = 0;
+		for (n = 1; n < sna_crtc->shadow_swap_count; n++)
+			if (sna_crtc->frame - sna_crtc->shadow_swap[n].frame >
+			    sna_crtc->frame - sna_crtc->shadow_swap[oldest].frame)
+				oldest = n;
+
+		bo = sna_crtc->shadow_swap[oldest].bo;
+		since = sna_crtc->shadow_swap[oldest].frame;
+		sna_crtc->shadow_swap[oldest] = sna_crtc->shadow_swap[--sna_crtc->shadow_swap_count];
+	}
+
+	shadow_swap_damage(sna_crtc, damage, since);
+	return bo;
+}
+
+static void
+shadow_swap_put(struct sna *sna, struct sna_crtc *sna_crtc,
+		struct kgem_bo *bo, unsigned frame)
+{
+	DBG(("%s: CRTC:%d handle=%d, frame=%d, idle=%d\n",
+	     __FUNCTION__, __sna_crtc_id(sna_crtc), bo->handle,
+	     frame, sna_crtc->shadow_swap_count + 1));
+
+	if (sna_crtc->shadow_swap_count == ARRAY_SIZE(sna_crtc->shadow_swap)) {
+		kgem_bo_destroy(&sna->kgem, bo);
+		return;
+	}
+
+	sna_crtc->shadow_swap[sna_crtc->shadow_swap_count].bo = bo;
+	sna_crtc->shadow_swap[sna_crtc->shadow_swap_count].frame = frame;
+	sna_crtc->shadow_swap_count++;
+}
+
+static void __sna_mode_redisplay(struct sna *sna)
 {
 	xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(sna->scrn);
 	RegionPtr region;
@@ -9065,28 +9747,22 @@ void sna_mode_redisplay(struct sna *sna)
 		sigio = sigio_block();
 		if (!box_empty(&damage.extents)) {
 			if (sna->flags & SNA_TEAR_FREE) {
-				RegionRec new_damage;
 				struct drm_mode_crtc_page_flip arg;
 				struct kgem_bo *bo;
+				unsigned frame;
 
-				RegionNull(&new_damage);
-				RegionCopy(&new_damage, &damage);
-
-				bo = sna_crtc->cache_bo;
+				frame = shadow_swap_begin(sna_crtc, &damage);
+				bo = shadow_swap_get(sna, sna_crtc, &damage);
 				if (bo == NULL) {
-					damage.extents = crtc->bounds;
-					damage.data = NULL;
-					bo = kgem_create_2d(&sna->kgem,
-							    crtc->mode.HDisplay,
-							    crtc->mode.VDisplay,
-							    crtc->scrn->bitsPerPixel,
-							    sna_crtc->bo->tiling,
-							    CREATE_SCANOUT);
-					if (bo == NULL)
-						continue;
-				} else
-					RegionUnion(&damage, &damage, &sna_crtc->crtc_damage);
-				sna_crtc->crtc_damage = new_damage;
+					DBG(("%s: no idle buffer for CRTC:%d, updating scanout in place\n",
+					     __FUNCTION__, __sna_crtc_id(sna_crtc)));
+					shadow_swap_damage(sna_crtc, &damage,
+							   sna_crtc->bo_frame);
+					sna_crtc_redisplay(crtc, &damage, sna_crtc->bo);
+					kgem_scanout_flush(&sna->kgem, sna_crtc->bo);
+					sna_crtc->bo_frame = frame;
+					goto next_crtc;
+				}
 
 				sna_crtc_redisplay(crtc, &damage, bo);
 				kgem_bo_submit(&sna->kgem, bo);
@@ -9116,6 +9792,7 @@ void sna_mode_redisplay(struct sna *sna)
 
 						sna_crtc->bo = kgem_bo_reference(bo);
 						sna_crtc->bo->active_scanout++;
+						sna_crtc->bo_frame = frame;
 					} else {
 						BoxRec box;
 						DrawableRec tmp;
@@ -9127,6 +9804,7 @@ void sna_mode_redisplay(struct sna *sna)
 						sna->flags &= ~SNA_TEAR_FREE;
 
 disable1:
+						sna_crtc->bo_frame = 0;
 						box.x1 = 0;
 						box.y1 = 0;
 						tmp.width = box.x2 = crtc->mode.HDisplay;
@@ -9146,8 +9824,7 @@ disable1:
 					}
 
 					kgem_bo_destroy(&sna->kgem, bo);
-					sna_crtc->cache_bo = NULL;
-					continue;
+					goto next_crtc;
 				}
 				sna->mode.flip_active++;
 
@@ -9162,8 +9839,11 @@ disable1:
 				if (sna_crtc->bo != sna->mode.shadow) {
 					assert_scanout(&sna->kgem, sna_crtc->bo,
 						       crtc->mode.HDisplay, crtc->mode.VDisplay);
-					sna_crtc->cache_bo = kgem_bo_reference(sna_crtc->bo);
+					shadow_swap_put(sna, sna_crtc,
+							kgem_bo_reference(sna_crtc->bo),
+							sna_crtc->bo_frame);
 				}
+				sna_crtc->bo_frame = frame;
 				DBG(("%s: recording flip on CRTC:%d handle=%d, active_scanout=%d, serial=%d\n",
 				     __FUNCTION__, __sna_crtc_id(sna_crtc), sna_crtc->flip_bo->handle, sna_crtc->flip_bo->active_scanout, sna_crtc->flip_serial));
 			} else {
@@ -9171,6 +9851,7 @@ disable1:
 				kgem_scanout_flush(&sna->kgem, sna_crtc->bo);
 			}
 		}
+next_crtc:
 		RegionUninit(&damage);
 		sigio_unblock(sigio);
 
@@ -9356,6 +10037,14 @@ fixup_flip:
 	RegionEmpty(region);
 }
 
+void sna_mode_redisplay(struct sna *sna)
+{
+	if (latch_defer(sna))
+		return;
+
+	__sna_mode_redisplay(sna);
+}
+
 int sna_mode_wakeup(struct sna *sna)
 {
 	char buffer[1024];
@@ -9450,6 +10139,8 @@ again:
 				if (--sna->mode.flip_active == 0) {
 					assert(crtc->flip_handler);
 					crtc->flip_handler(vbl, crtc->flip_data);
+					if (sna->mode.flip_active == 0)
+						sna_present_flip_idle(sna);
 				}
 			}
 			break;
@@ -2153,6 +2153,36 @@ can_flip(struct sna * sna,
 	return true;
 }
 
+static bool
+owns_redirected_pixmap(WindowPtr win, PixmapPtr pixmap)
+{
+#ifdef COMPOSITE
+	/* A redirected window's pixmap is its complete backing store, so
+	 * what covers it on screen is irrelevant to an exchange. We only
+	 * have to be sure that nothing else (a border or children) is
+	 * stored inside the pixmap alongside the window contents.
+	 */
+	if (win->redirectDraw == RedirectDrawNone)
+		return false;
+
+	if (win->firstChild || wBorderWidth(win))
+		return false;
+
+	if (pixmap->screen_x != win->drawable.x ||
+	    pixmap->screen_y != win->drawable.y)
+		return false;
+
+	DBG(("%s: redirected window=%ld, pixmap %dx%d, window %dx%d\n",
+	     __FUNCTION__, win->drawable.id,
+	     pixmap->drawable.width, pixmap->drawable.height,
+	     win->drawable.width, win->drawable.height));
+	return (pixmap->drawable.width == win->drawable.width &&
+		pixmap->drawable.height == win->drawable.height);
+#else
+	return false;
+#endif
+}
+
 static bool
 can_xchg(struct sna *sna,
 	 DrawablePtr draw,
@@ -2191,7 +2221,8 @@ can_xchg(struct sna *sna,
 	     region_num_rects(&win->clipList),
 	     pixmap->drawable.width,
 	     pixmap->drawable.height));
-	if (is_clipped(&win->clipList, &pixmap->drawable)) {
+	if (is_clipped(&win->clipList, &pixmap->drawable) &&
+	    !owns_redirected_pixmap(win, pixmap)) {
 		DBG(("%s: no, %dx%d window is clipped: clip region=(%d, %d), (%d, %d)\n",
 		     __FUNCTION__,
 		     draw->width, draw->height,
@@ -3417,8 +3448,13 @@ sna_dri2_schedule_swap(ClientPtr client, DrawablePtr draw, DRI2BufferPtr front,
 
 	info->type = SWAP;
 	if (*target_msc <= current_msc + 1) {
-		DBG(("%s: performing blit before queueing\n", __FUNCTION__));
-		__sna_dri2_copy_event(info, DRI2_SYNC);
+		if (can_xchg(sna, draw, front, back)) {
+			DBG(("%s: performing xchg before queueing\n", __FUNCTION__));
+			sna_dri2_xchg(draw, front, back);
+		} else {
+			DBG(("%s: performing blit before queueing\n", __FUNCTION__));
+			__sna_dri2_copy_event(info, DRI2_SYNC);
+		}
 		info->type = SWAP_COMPLETE;
 		if (!sna_next_vblank(info))
 			goto fake;
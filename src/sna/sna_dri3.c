@@ -100,7 +100,14 @@ sna_sync_fence_set_triggered(SyncFence *fence)
 	struct sna *sna = to_sna_from_screen(fence->pScreen);
 	struct sna_sync_fence *sna_fence = sna_sync_fence(fence);
 
-	DBG(("%s()\n", __FUNCTION__));
+	/* The client waits upon the fence and then submits its own
+	 * rendering, relying upon implicit fencing of the shared bo to
+	 * serialise with ours. So our batch has to reach the kernel
+	 * before the fence is signalled. The fence itself is just shared
+	 * memory, there is no request we could attach it to instead;
+	 * sna_accel_flush() only breaks the batch if a shared bo is in it.
+	 */
+	DBG(("%s: flush?=%d\n", __FUNCTION__, sna->kgem.flush));
 	sna_accel_flush(sna);
 
 	fence->funcs.SetTriggered = sna_fence->set_triggered;
@@ -150,6 +157,56 @@ sna_sync_open(struct sna *sna, ScreenPtr screen)
 	return true;
 }
 
+static struct sna_pixmap *sna_dri3_lookup(struct sna *sna, int fd)
+{
+#ifdef DRM_IOCTL_PRIME_FD_TO_HANDLE
+	struct drm_prime_handle args;
+	struct sna_pixmap *priv;
+	uint32_t handle;
+
+	if (list_is_empty(&sna->dri3.pixmaps))
+		return NULL;
+
+	/* The kernel hands back the existing handle for a dma-buf we have
+	 * already imported, so that is all we need to identify it. Only
+	 * upon a miss do we pay for the tiling/caching queries and the new
+	 * bo in kgem_create_for_prime(). We leave a new handle open: the
+	 * kernel returns that same handle to kgem_create_for_prime(),
+	 * which then either adopts it into the bo or closes it on failure.
+	 */
+	VG_CLEAR(args);
+	args.fd = fd;
+	args.flags = 0;
+	if (drmIoctl(sna->kgem.fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &args))
+		return NULL;
+	handle = args.handle;
+
+	list_for_each_entry(priv, &sna->dri3.pixmaps, cow_list) {
+		struct kgem_bo *bo;
+
+		if (priv->pinned & PIN_DRI3) {
+			assert(priv->gpu_bo);
+			bo = priv->gpu_bo;
+		} else {
+			assert(priv->cpu_bo);
+			assert(IS_STATIC_PTR(priv->ptr));
+			bo = priv->cpu_bo;
+		}
+		if (bo->handle != handle)
+			continue;
+
+		DBG(("%s: fd=%d found handle=%d, pixmap=%ld\n",
+		     __FUNCTION__, fd, handle,
+		     priv->pixmap->drawable.serialNumber));
+		list_move(&priv->cow_list, &sna->dri3.pixmaps);
+		return priv;
+	}
+
+	DBG(("%s: fd=%d, new handle=%d\n", __FUNCTION__, fd, handle));
+#endif
+	return NULL;
+}
+
 static int sna_dri3_open_device(ScreenPtr screen,
 				RRProviderPtr provider,
 				int *out)
@@ -198,48 +255,36 @@ static PixmapPtr sna_dri3_pixmap_from_fd(ScreenPtr screen,
 		return NULL;
 	}
 
-	bo = kgem_create_for_prime(&sna->kgem, fd, (uint32_t)stride * height);
-	if (bo == NULL)
-		return NULL;
-
 	/* Check for a duplicate */
-	list_for_each_entry(priv, &sna->dri3.pixmaps, cow_list) {
-		int other_stride = 0;
-		if (bo->snoop) {
-			assert(priv->cpu_bo);
-			assert(IS_STATIC_PTR(priv->ptr));
-			if (bo->handle == priv->cpu_bo->handle)
-				other_stride = priv->cpu_bo->pitch;
-		} else  {
-			assert(priv->gpu_bo);
-			assert(priv->pinned & PIN_DRI3);
-			if (bo->handle == priv->gpu_bo->handle)
-				other_stride = priv->gpu_bo->pitch;
-		}
-		if (other_stride) {
-			pixmap = priv->pixmap;
-			DBG(("%s: imported fd matches existing DRI3 pixmap=%ld\n", __FUNCTION__, pixmap->drawable.serialNumber));
-			bo->handle = 0; /* fudge to prevent gem_close */
-			kgem_bo_destroy(&sna->kgem, bo);
-			if (width != pixmap->drawable.width ||
-			    height != pixmap->drawable.height ||
-			    depth != pixmap->drawable.depth ||
-			    bpp != pixmap->drawable.bitsPerPixel ||
-			    stride != other_stride) {
-				DBG(("%s: imported fd mismatches existing DRI3 pixmap (width=%d, height=%d, depth=%d, bpp=%d, stride=%d)\n", __FUNCTION__,
-				     pixmap->drawable.width,
-				     pixmap->drawable.height,
-				     pixmap->drawable.depth,
-				     pixmap->drawable.bitsPerPixel,
-				     other_stride));
-				return NULL;
-			}
-			sna_sync_flush(sna, priv);
-			pixmap->refcnt++;
-			return pixmap;
+	priv = sna_dri3_lookup(sna, fd);
+	if (priv) {
+		int other_stride;
+
+		pixmap = priv->pixmap;
+		other_stride = priv->pinned & PIN_DRI3 ? priv->gpu_bo->pitch : priv->cpu_bo->pitch;
+		DBG(("%s: imported fd matches existing DRI3 pixmap=%ld\n", __FUNCTION__, pixmap->drawable.serialNumber));
+		if (width != pixmap->drawable.width ||
+		    height != pixmap->drawable.height ||
+		    depth != pixmap->drawable.depth ||
+		    bpp != pixmap->drawable.bitsPerPixel ||
+		    stride != other_stride) {
+			DBG(("%s: imported fd mismatches existing DRI3 pixmap (width=%d, height=%d, depth=%d, bpp=%d, stride=%d)\n", __FUNCTION__,
+			     pixmap->drawable.width,
+			     pixmap->drawable.height,
+			     pixmap->drawable.depth,
+			     pixmap->drawable.bitsPerPixel,
+			     other_stride));
+			return NULL;
 		}
+		sna_sync_flush(sna, priv);
+		pixmap->refcnt++;
+		return pixmap;
 	}
 
+	bo = kgem_create_for_prime(&sna->kgem, fd, (uint32_t)stride * height);
+	if (bo == NULL)
+		return NULL;
+
 	if (!kgem_check_surface_size(&sna->kgem,
 				     width, height, bpp,
 				     bo->tiling, stride, kgem_bo_size(bo))) {
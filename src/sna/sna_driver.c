@@ -472,6 +472,7 @@ static bool setup_tear_free(struct sna *sna)
 {
 	MessageType from;
 	Bool enable;
+	int buffers;
 
 	if (sna->flags & SNA_LINEAR_FB)
 		return false;
@@ -490,6 +491,15 @@ static bool setup_tear_free(struct sna *sna)
 	if (enable)
 		sna->flags |= SNA_WANT_TEAR_FREE | SNA_TEAR_FREE;
 
+	/* Buffers in the swapchain of each transformed output */
+	if (!xf86GetOptValInteger(sna->Options, OPTION_TEAR_FREE_BUFFERS, &buffers))
+		buffers = 2;
+	if (buffers < 2)
+		buffers = 2;
+	if (buffers > SHADOW_MAX_BUFFERS)
+		buffers = SHADOW_MAX_BUFFERS;
+	sna->mode.shadow_buffers = buffers;
+
 done:
 	xf86DrvMsg(sna->scrn->scrnIndex, from, "TearFree %sabled\n",
 		   sna->flags & SNA_TEAR_FREE ? "en" : "dis");
@@ -744,6 +754,8 @@ sna_wakeup_handler(WAKEUPHANDLER_ARGS_DECL)
 		/* Clear the flag so that subsequent ZaphodHeads don't block  */
 		FD_CLR(sna->kgem.fd, (fd_set*)read_mask);
 	}
+
+	sna_mode_latch_wakeup(sna, read_mask);
 }
 #else
 static void
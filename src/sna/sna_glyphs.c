@@ -1997,6 +1997,9 @@ sna_glyphs(CARD8 op,
 	if (RegionNil(dst->pCompositeClip))
 		return;
 
+	sna_picture_flush_deferred(src);
+	sna_picture_flush_deferred(dst);
+
 	if (FALLBACK)
 		goto fallback;
 
@@ -2321,6 +2324,9 @@ sna_glyphs__shared(CARD8 op,
 	if (RegionNil(dst->pCompositeClip))
 		return;
 
+	sna_picture_flush_deferred(src);
+	sna_picture_flush_deferred(dst);
+
 	if (FALLBACK)
 		goto fallback;
 
@@ -36,6 +36,8 @@
 #include <xf86.h>
 #include <present.h>
 
+#define NO_FLIP_QUEUE 0
+
 static present_screen_info_rec present_info;
 
 struct sna_present_event {
@@ -46,6 +48,7 @@ struct sna_present_event {
 	uint64_t target_msc;
 	int n_event_id;
 	bool queued;
+	bool armed;
 };
 
 static void sna_present_unflip(ScreenPtr screen, uint64_t event_id);
@@ -137,19 +140,15 @@ static uint64_t gettime_ust64(void)
 	return ust64(tv.tv_sec, tv.tv_nsec / 1000);
 }
 
-static void vblank_complete(struct sna_present_event *info,
-			    uint64_t ust, uint64_t msc)
+static void vblank_notify(struct sna_present_event *info,
+			  uint64_t ust, uint64_t msc)
 {
 	int n;
 
-	if (msc_before(msc, info->target_msc)) {
-		DBG(("%s: event=%d too early, now %lld, expected %lld\n",
-		     __FUNCTION__,
-		     info->event_id[0],
-		     (long long)msc, (long long)info->target_msc));
-		if (sna_present_queue(info, msc))
-			return;
-	}
+	/* Present may requeue from within the notify, so first remove
+	 * ourselves from the timeline.
+	 */
+	list_del(&info->link);
 
 	DBG(("%s: %d events complete\n", __FUNCTION__, info->n_event_id));
 	for (n = 0; n < info->n_event_id; n++) {
@@ -163,10 +162,79 @@ static void vblank_complete(struct sna_present_event *info,
 	}
 	if (info->n_event_id > 1)
 		free(info->event_id);
-	list_del(&info->link);
 	info_free(info);
 }
 
+/* The vblank_queue is kept sorted by target msc and acts as a timeline
+ * for each CRTC: only the earliest pending event on each CRTC holds a
+ * kernel vblank event (or a fake vblank timer). When it fires, every
+ * other event on that CRTC that has since become due is completed using
+ * the same timestamp, and then the next event in line is armed.
+ */
+static void vblank_dispatch(struct sna *sna, xf86CrtcPtr crtc,
+			    uint64_t ust, uint64_t msc)
+{
+	struct sna_present_event *info;
+
+	/* Completing an event may queue (or complete) others, so rescan
+	 * the timeline after each rather than trusting a saved successor.
+	 */
+complete:
+	list_for_each_entry(info, &sna->present.vblank_queue, link) {
+		if (unmask_crtc(info->crtc) != crtc)
+			continue;
+
+		if (info->armed || msc_before(msc, info->target_msc))
+			continue;
+
+		DBG(("%s: pipe=%d, completing coalesced event=%lld (target=%lld) at msc=%lld\n",
+		     __FUNCTION__, sna_crtc_pipe(crtc),
+		     (long long)info->event_id[0],
+		     (long long)info->target_msc,
+		     (long long)msc));
+		vblank_notify(info, ust, msc);
+		goto complete;
+	}
+
+restart:
+	list_for_each_entry(info, &sna->present.vblank_queue, link) {
+		if (unmask_crtc(info->crtc) != crtc)
+			continue;
+
+		if (info->armed)
+			return;
+
+		DBG(("%s: pipe=%d, arming next event=%lld (target=%lld)\n",
+		     __FUNCTION__, sna_crtc_pipe(crtc),
+		     (long long)info->event_id[0],
+		     (long long)info->target_msc));
+		if (!sna_present_queue(info, msc)) {
+			vblank_notify(info, gettime_ust64(), info->target_msc);
+			goto restart;
+		}
+		return;
+	}
+}
+
+static void vblank_complete(struct sna_present_event *info,
+			    uint64_t ust, uint64_t msc)
+{
+	struct sna *sna = info->sna;
+	xf86CrtcPtr crtc = unmask_crtc(info->crtc);
+
+	if (msc_before(msc, info->target_msc)) {
+		DBG(("%s: event=%d too early, now %lld, expected %lld\n",
+		     __FUNCTION__,
+		     info->event_id[0],
+		     (long long)msc, (long long)info->target_msc));
+		if (sna_present_queue(info, msc))
+			return;
+	}
+
+	vblank_notify(info, ust, msc);
+	vblank_dispatch(sna, crtc, ust, msc);
+}
+
 static uint32_t msc_to_delay(xf86CrtcPtr crtc, uint64_t target)
 {
 	const DisplayModeRec *mode = &crtc->desiredMode;
@@ -316,6 +384,8 @@ static bool sna_present_queue(struct sna_present_event *info,
 	assert(info->target_msc - last_msc < 1ull<<31);
 	assert(delta >= 0);
 
+	info->armed = true;
+
 	VG_CLEAR(vbl);
 	vbl.request.type = DRM_VBLANK_ABSOLUTE | DRM_VBLANK_EVENT;
 	vbl.request.sequence = info->target_msc;
@@ -323,8 +393,10 @@ static bool sna_present_queue(struct sna_present_event *info,
 	if (delta > 2 ||
 	    sna_wait_vblank(info->sna, &vbl, sna_crtc_pipe(info->crtc))) {
 		DBG(("%s: vblank enqueue failed, faking delta=%d\n", __FUNCTION__, delta));
-		if (!sna_fake_vblank(info))
+		if (!sna_fake_vblank(info)) {
+			info->armed = false;
 			return false;
+		}
 	} else {
 		info->queued = true;
 		if (delta == 1) {
@@ -389,6 +461,7 @@ sna_present_get_ust_msc(RRCrtcPtr crtc, CARD64 *ust, CARD64 *msc)
 			info->target_msc = *msc + 1;
 			info->event_id = (uint64_t *)(info + 1);
 			info->n_event_id = 0;
+			info->armed = true;
 
 			vbl.request.type =
 				DRM_VBLANK_ABSOLUTE | DRM_VBLANK_EVENT;
@@ -520,6 +593,24 @@ sna_present_queue_vblank(RRCrtcPtr crtc, uint64_t event_id, uint64_t msc)
 	info->n_event_id = 1;
 	list_add_tail(&info->link, &tmp->link);
 	info->queued = false;
+	info->armed = false;
+
+	/* Only the earliest event on each CRTC waits for the vblank */
+	list_for_each_entry(tmp, &sna->present.vblank_queue, link) {
+		if (tmp == info)
+			break;
+
+		/* The earlier event is either armed, or we are being
+		 * requeued whilst completing events on this CRTC and
+		 * vblank_dispatch() will arm the next one afterwards.
+		 */
+		if (unmask_crtc(tmp->crtc) == info->crtc) {
+			DBG(("%s: event=%lld waiting behind target msc=%lld (armed? %d)\n",
+			     __FUNCTION__, (long long)event_id,
+			     (long long)tmp->target_msc, tmp->armed));
+			return Success;
+		}
+	}
 
 	if (!sna_present_queue(info, swap->msc)) {
 		list_del(&info->link);
@@ -834,6 +925,7 @@ sna_present_flip(RRCrtcPtr crtc,
 {
 	struct sna *sna = to_sna_from_pixmap(pixmap);
 	struct kgem_bo *bo;
+	bool shadow;
 
 	DBG(("%s(pipe=%d, event=%lld, msc=%lld, pixmap=%ld, sync?=%d)\n",
 	     __FUNCTION__,
@@ -849,9 +941,10 @@ sna_present_flip(RRCrtcPtr crtc,
 
 	assert(sna->present.unflip == 0);
 
+	shadow = sna->mode.shadow_enabled;
 	if (sna->flags & SNA_TEAR_FREE) {
 		DBG(("%s: disabling TearFree (was %s) in favour of Present flips\n",
-		     __FUNCTION__, sna->mode.shadow_enabled ? "enabled" : "disabled"));
+		     __FUNCTION__, shadow ? "enabled" : "disabled"));
 		sna->mode.shadow_enabled = false;
 	}
 	assert(!sna->mode.shadow_enabled);
@@ -864,20 +957,54 @@ sna_present_flip(RRCrtcPtr crtc,
 		pfd.events = POLLIN;
 		while (poll(&pfd, 1, 0) == 1)
 			sna_mode_wakeup(sna);
-		if (sna->mode.flip_active)
-			return FALSE;
 	}
 
 	bo = get_flip_bo(pixmap);
 	if (bo == NULL) {
 		DBG(("%s: flip invalid bo\n", __FUNCTION__));
-		return FALSE;
+		goto fail;
 	}
 
-	if (sync_flip)
-		return flip(sna, crtc, event_id, target_msc, bo);
-	else
-		return flip__async(sna, crtc, event_id, target_msc, bo);
+	if (sna->mode.flip_active) {
+		/* Someone else (e.g. the final TearFree update) still owns
+		 * the scanout. Rather than make the client copy, hold onto
+		 * the flip and issue it as soon as the CRTCs are idle.
+		 * Present itself never has more than one flip outstanding,
+		 * so a single slot suffices.
+		 */
+		if (NO_FLIP_QUEUE || sna->present.queued.bo) {
+			DBG(("%s: flip already queued\n", __FUNCTION__));
+			goto fail;
+		}
+
+		DBG(("%s: %d flips still pending, queueing flip of handle=%d\n",
+		     __FUNCTION__, sna->mode.flip_active, bo->handle));
+		sna->present.queued.bo = kgem_bo_reference(bo);
+		sna->present.queued.crtc = crtc;
+		sna->present.queued.event_id = event_id;
+		sna->present.queued.target_msc = target_msc;
+		sna->present.queued.sync = sync_flip;
+		return TRUE;
+	}
+
+	if (sync_flip) {
+		if (flip(sna, crtc, event_id, target_msc, bo))
+			return TRUE;
+	} else {
+		if (flip__async(sna, crtc, event_id, target_msc, bo))
+			return TRUE;
+	}
+
+fail:
+	/* Present falls back to copying into the front buffer, in
+	 * which case TearFree must still be used to get it onto the
+	 * screen. There is no unflip to restore it for us.
+	 */
+	if (sna->flags & SNA_TEAR_FREE && shadow) {
+		DBG(("%s: flip failed, restoring TearFree\n", __FUNCTION__));
+		sna->mode.shadow_enabled = true;
+	}
+	return FALSE;
 }
 
 static void
@@ -940,8 +1067,115 @@ reset_mode:
 		goto reset_mode;
 }
 
+static bool
+flip__copy(struct sna *sna, struct kgem_bo *bo)
+{
+	PixmapPtr front = sna->front;
+	struct sna_pixmap *priv;
+	RegionRec region;
+	bool ok;
+
+	/* Present has already been told that the flip is under way, so it
+	 * can no longer copy the frame for us. Do that ourselves, onto the
+	 * front buffer from which TearFree or the restored scanout will
+	 * show it.
+	 */
+	priv = sna_pixmap_move_to_gpu(front, MOVE_READ | MOVE_WRITE | __MOVE_FORCE);
+	if (priv == NULL)
+		return false;
+
+	DBG(("%s: copying handle=%d onto front handle=%d\n",
+	     __FUNCTION__, bo->handle, priv->gpu_bo->handle));
+
+	region.extents.x1 = region.extents.y1 = 0;
+	region.extents.x2 = front->drawable.width;
+	region.extents.y2 = front->drawable.height;
+	region.data = NULL;
+	DamageRegionAppend(&front->drawable, &region);
+
+	ok = sna->render.copy_boxes(sna, GXcopy,
+				    &front->drawable, bo, 0, 0,
+				    &front->drawable, priv->gpu_bo, 0, 0,
+				    &region.extents, 1, 0);
+	if (ok)
+		sna_damage_all(&priv->gpu_damage, front);
+
+	DamageRegionProcessPending(&front->drawable);
+	return ok;
+}
+
+void sna_present_flip_idle(struct sna *sna)
+{
+	struct kgem_bo *bo;
+	Bool ret;
+
+	bo = sna->present.queued.bo;
+	if (bo == NULL)
+		return;
+
+	assert(sna->mode.flip_active == 0);
+	sna->present.queued.bo = NULL;
+
+	DBG(("%s: issuing queued flip (event=%lld, handle=%d)\n",
+	     __FUNCTION__, (long long)sna->present.queued.event_id, bo->handle));
+	if (sna->present.queued.sync)
+		ret = flip(sna, sna->present.queued.crtc,
+			   sna->present.queued.event_id,
+			   sna->present.queued.target_msc,
+			   bo);
+	else
+		ret = flip__async(sna, sna->present.queued.crtc,
+				  sna->present.queued.event_id,
+				  sna->present.queued.target_msc,
+				  bo);
+
+	if (!ret) {
+		const struct ust_msc *swap;
+
+		/* Too late to ask Present to copy instead, so copy the
+		 * frame onto the front buffer ourselves and let TearFree
+		 * resume until the next flip. Without TearFree, put the
+		 * front buffer back on the scanout to show it.
+		 */
+		DBG(("%s: queued flip failed\n", __FUNCTION__));
+		if (sna->flags & SNA_TEAR_FREE)
+			sna->mode.shadow_enabled = sna->mode.shadow_damage != NULL;
+
+		if (flip__copy(sna, bo) &&
+		    !sna->mode.shadow_enabled &&
+		    sna_needs_page_flip(sna, sna_pixmap(sna->front)->gpu_bo)) {
+			DBG(("%s: restoring front buffer to the scanout\n", __FUNCTION__));
+			xf86SetDesiredModes(sna->scrn);
+		}
+
+		swap = sna_crtc_last_swap(sna->present.queued.crtc->devPrivate);
+		present_event_notify(sna->present.queued.event_id,
+				     swap_ust(swap), swap->msc);
+	}
+
+	kgem_bo_destroy(&sna->kgem, bo);
+}
+
 void sna_present_cancel_flip(struct sna *sna)
 {
+	if (sna->present.queued.bo) {
+		const struct ust_msc *swap;
+
+		/* The frame never reached the scanout, so copy it onto the
+		 * front buffer before completing the event.
+		 */
+		DBG(("%s: cancelling queued flip (event=%lld)\n",
+		     __FUNCTION__, (long long)sna->present.queued.event_id));
+		flip__copy(sna, sna->present.queued.bo);
+
+		swap = sna_crtc_last_swap(sna->present.queued.crtc->devPrivate);
+		present_event_notify(sna->present.queued.event_id,
+				     swap_ust(swap), swap->msc);
+
+		kgem_bo_destroy(&sna->kgem, sna->present.queued.bo);
+		sna->present.queued.bo = NULL;
+	}
+
 	if (sna->present.unflip) {
 		const struct ust_msc *swap;
 
@@ -977,6 +1211,7 @@ bool sna_present_open(struct sna *sna, ScreenPtr screen)
 
 	sna_present_update(sna);
 	list_init(&sna->present.vblank_queue);
+	sna->present.queued.bo = NULL;
 
 	return present_screen_init(screen, &present_info);
 }
@@ -995,4 +1230,9 @@ void sna_present_update(struct sna *sna)
 void sna_present_close(struct sna *sna, ScreenPtr screen)
 {
 	DBG(("%s()\n", __FUNCTION__));
+
+	if (sna->present.queued.bo) {
+		kgem_bo_destroy(&sna->kgem, sna->present.queued.bo);
+		sna->present.queued.bo = NULL;
+	}
 }
@@ -373,3 +373,76 @@ void sna_image_composite(pixman_op_t        op,
 			sna_threads_kill();
 	}
 }
+
+struct thread_bands {
+	void (*func)(void *arg, int y, int height);
+	void *arg;
+	int y, height;
+};
+
+static void thread_bands(void *arg)
+{
+	struct thread_bands *t = arg;
+	t->func(t->arg, t->y, t->height);
+}
+
+/* Split an operation on rows [0, height) into horizontal bands across the
+ * thread pool. Returns false if the caller should just run it inline,
+ * i.e. the operation is too small or we are already inside a band.
+ */
+bool sna_threads_bands(int width, int height, int threshold,
+		       void (*func)(void *arg, int y, int height),
+		       void *arg)
+{
+	static bool active;
+	int num_threads;
+
+	if (active)
+		return false;
+
+	num_threads = sna_use_threads(width, height, threshold);
+	if (num_threads <= 1)
+		return false;
+
+	if (!pthread_equal(pthread_self(), threads[0].thread))
+		return false;
+
+	DBG(("%s: using %d threads for %dx%d\n",
+	     __FUNCTION__, num_threads, width, height));
+
+	active = true;
+	{
+		struct thread_bands data[num_threads];
+		int y, dy, n;
+
+		y = 0;
+		dy = (height + num_threads - 1) / num_threads;
+		num_threads -= (num_threads-1) * dy >= height;
+
+		data[0].func = func;
+		data[0].arg = arg;
+
+		if (sigtrap_get() == 0) {
+			for (n = 1; n < num_threads; n++) {
+				data[n] = data[0];
+				data[n].y = y;
+				data[n].height = dy;
+				y += dy;
+
+				sna_threads_run(n, thread_bands, &data[n]);
+			}
+
+			assert(y < height);
+			data[0].y = y;
+			data[0].height = height - y;
+			thread_bands(&data[0]);
+
+			sna_threads_wait();
+			sigtrap_put();
+		} else
+			sna_threads_kill();
+	}
+	active = false;
+
+	return true;
+}
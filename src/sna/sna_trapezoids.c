@@ -556,6 +556,343 @@ out:
 	return dst->pDrawable->width <= TOR_INPLACE_SIZE;
 }
 
+/* Cache of rasterised masks for repeated trapezoid geometry.
+ *
+ * Widget themes tend to submit the same set of trapezoids (e.g. the
+ * corners of a rounded rectangle) every frame, only translated. We key
+ * the cache on the trapezoid list relative to the integer origin of its
+ * bounds, so any repeat is just a single composite with the cached a8
+ * mask. To avoid rendering every one-off set twice, the first sighting
+ * only records the geometry and the mask is built upon the second.
+ */
+#define TRAPS_CACHE_HASH 64
+#define TRAPS_CACHE_MAX_ENTRIES 256
+#define TRAPS_CACHE_MAX_TRAPS 256
+#define TRAPS_CACHE_MAX_PIXELS (256*256)
+#define TRAPS_CACHE_MAX_BYTES (8 << 20)
+
+struct traps_cache_entry {
+	struct list link;
+	struct traps_cache_entry *next;
+	PicturePtr mask;
+	uint32_t hash;
+	uint32_t format;
+	unsigned int polyEdge : 1;
+	unsigned int polyMode : 1;
+	int width, height;
+	int size;
+	int ntrap;
+	xTrapezoid traps[];
+};
+
+struct sna_traps_cache {
+	struct list lru;
+	struct traps_cache_entry *hash[TRAPS_CACHE_HASH];
+	unsigned long size;
+	int count;
+	bool filling;
+
+	unsigned long hits, misses, evictions;
+};
+
+static uint32_t traps_hash(uint32_t h, xFixed v)
+{
+	/* FNV-1a, a word at a time */
+	return (h ^ v) * 16777619;
+}
+
+static uint32_t
+traps_cache_hash(int ntrap, const xTrapezoid *t, xFixed dx, xFixed dy)
+{
+	uint32_t h = 2166136261;
+
+	do {
+		h = traps_hash(h, t->top - dy);
+		h = traps_hash(h, t->bottom - dy);
+		h = traps_hash(h, t->left.p1.x - dx);
+		h = traps_hash(h, t->left.p1.y - dy);
+		h = traps_hash(h, t->left.p2.x - dx);
+		h = traps_hash(h, t->left.p2.y - dy);
+		h = traps_hash(h, t->right.p1.x - dx);
+		h = traps_hash(h, t->right.p1.y - dy);
+		h = traps_hash(h, t->right.p2.x - dx);
+		h = traps_hash(h, t->right.p2.y - dy);
+	} while (t++, --ntrap);
+
+	return h;
+}
+
+static bool
+traps_cache_equal(const struct traps_cache_entry *e,
+		  int ntrap, const xTrapezoid *t, xFixed dx, xFixed dy)
+{
+	const xTrapezoid *c = e->traps;
+
+	if (e->ntrap != ntrap)
+		return false;
+
+	do {
+		if (c->top != t->top - dy ||
+		    c->bottom != t->bottom - dy ||
+		    c->left.p1.x != t->left.p1.x - dx ||
+		    c->left.p1.y != t->left.p1.y - dy ||
+		    c->left.p2.x != t->left.p2.x - dx ||
+		    c->left.p2.y != t->left.p2.y - dy ||
+		    c->right.p1.x != t->right.p1.x - dx ||
+		    c->right.p1.y != t->right.p1.y - dy ||
+		    c->right.p2.x != t->right.p2.x - dx ||
+		    c->right.p2.y != t->right.p2.y - dy)
+			return false;
+	} while (c++, t++, --ntrap);
+
+	return true;
+}
+
+static void
+traps_cache_remove(struct sna_traps_cache *cache,
+		   struct traps_cache_entry *entry)
+{
+	struct traps_cache_entry **p;
+
+	for (p = &cache->hash[entry->hash % TRAPS_CACHE_HASH];
+	     *p != entry;
+	     p = &(*p)->next)
+		;
+	*p = entry->next;
+
+	list_del(&entry->link);
+	cache->size -= entry->size;
+	cache->count--;
+
+	if (entry->mask)
+		FreePicture(entry->mask, 0);
+	free(entry);
+}
+
+static void
+traps_cache_evict(struct sna_traps_cache *cache, int size)
+{
+	while (!list_is_empty(&cache->lru) &&
+	       (cache->count >= TRAPS_CACHE_MAX_ENTRIES ||
+		cache->size + size > TRAPS_CACHE_MAX_BYTES)) {
+		struct traps_cache_entry *entry;
+
+		entry = list_last_entry(&cache->lru,
+					struct traps_cache_entry, link);
+		DBG(("%s: evicting %dx%d mask, %d traps\n",
+		     __FUNCTION__, entry->width, entry->height, entry->ntrap));
+		if (entry->mask)
+			cache->evictions++;
+		traps_cache_remove(cache, entry);
+	}
+}
+
+static struct traps_cache_entry *
+traps_cache_insert(struct sna_traps_cache *cache, uint32_t hash,
+		   PicturePtr dst, PictFormatPtr maskFormat,
+		   const BoxRec *bounds,
+		   int ntrap, const xTrapezoid *t, xFixed dx, xFixed dy)
+{
+	struct traps_cache_entry *entry;
+	xTrapezoid *c;
+
+	traps_cache_evict(cache, 0);
+
+	entry = malloc(sizeof(*entry) + ntrap * sizeof(xTrapezoid));
+	if (entry == NULL)
+		return NULL;
+
+	entry->mask = NULL;
+	entry->hash = hash;
+	entry->format = maskFormat->format;
+	entry->polyEdge = dst->polyEdge;
+	entry->polyMode = dst->polyMode;
+	entry->width = bounds->x2 - bounds->x1;
+	entry->height = bounds->y2 - bounds->y1;
+	entry->size = 0;
+	entry->ntrap = ntrap;
+
+	c = entry->traps;
+	do {
+		c->top = t->top - dy;
+		c->bottom = t->bottom - dy;
+		c->left.p1.x = t->left.p1.x - dx;
+		c->left.p1.y = t->left.p1.y - dy;
+		c->left.p2.x = t->left.p2.x - dx;
+		c->left.p2.y = t->left.p2.y - dy;
+		c->right.p1.x = t->right.p1.x - dx;
+		c->right.p1.y = t->right.p1.y - dy;
+		c->right.p2.x = t->right.p2.x - dx;
+		c->right.p2.y = t->right.p2.y - dy;
+	} while (c++, t++, --ntrap);
+
+	entry->next = cache->hash[hash % TRAPS_CACHE_HASH];
+	cache->hash[hash % TRAPS_CACHE_HASH] = entry;
+	list_add(&entry->link, &cache->lru);
+	cache->count++;
+
+	return entry;
+}
+
+static bool
+traps_cache_fill(struct sna *sna, struct sna_traps_cache *cache,
+		 struct traps_cache_entry *entry,
+		 ScreenPtr screen, PictFormatPtr maskFormat)
+{
+	PixmapPtr pixmap;
+	PicturePtr mask;
+	int size, error;
+
+	size = ALIGN(entry->width, 4) * entry->height;
+	traps_cache_evict(cache, size);
+	if (cache->size + size > TRAPS_CACHE_MAX_BYTES)
+		return false;
+
+	pixmap = screen->CreatePixmap(screen,
+				      entry->width, entry->height, 8,
+				      SNA_CREATE_SCRATCH);
+	if (pixmap == NULL)
+		return false;
+
+	mask = NULL;
+	if (sna_pixmap(pixmap))
+		mask = CreatePicture(0, &pixmap->drawable, maskFormat,
+				     0, 0, serverClient, &error);
+	screen->DestroyPixmap(pixmap);
+	if (mask == NULL)
+		return false;
+
+	ValidatePicture(mask);
+	mask->polyEdge = entry->polyEdge;
+	mask->polyMode = entry->polyMode;
+
+	/* Src is unbounded, so this also clears the fresh pixmap */
+	cache->filling = true;
+	sna_composite_trapezoids(PictOpSrc,
+				 sna->render.white_picture, mask, maskFormat,
+				 0, 0,
+				 entry->ntrap, entry->traps);
+	cache->filling = false;
+
+	entry->mask = mask;
+	entry->size = size;
+	cache->size += size;
+	return true;
+}
+
+static bool
+traps_cache_composite(struct sna *sna,
+		      CARD8 op, PicturePtr src, PicturePtr dst,
+		      PictFormatPtr maskFormat,
+		      INT16 xSrc, INT16 ySrc,
+		      int ntrap, xTrapezoid *traps)
+{
+	struct sna_traps_cache *cache;
+	struct traps_cache_entry *entry;
+	int16_t dst_x, dst_y;
+	xFixed dx, dy;
+	BoxRec bounds;
+	uint32_t hash;
+
+	if (NO_TRAPS_CACHE)
+		return false;
+
+	if (maskFormat == NULL || maskFormat->format != PICT_a8 ||
+	    is_mono(dst, maskFormat))
+		return false;
+
+	if (ntrap > TRAPS_CACHE_MAX_TRAPS ||
+	    sna->render.white_picture == NULL)
+		return false;
+
+	cache = sna->traps_cache;
+	if (cache == NULL) {
+		cache = calloc(1, sizeof(*cache));
+		if (cache == NULL)
+			return false;
+
+		list_init(&cache->lru);
+		sna->traps_cache = cache;
+	}
+
+	if (cache->filling)
+		return false;
+
+	if (!trapezoids_bounds(ntrap, traps, &bounds))
+		return false;
+
+	if ((bounds.x2 - bounds.x1) * (bounds.y2 - bounds.y1) > TRAPS_CACHE_MAX_PIXELS)
+		return false;
+
+	dx = pixman_int_to_fixed(bounds.x1);
+	dy = pixman_int_to_fixed(bounds.y1);
+	hash = traps_cache_hash(ntrap, traps, dx, dy);
+
+	for (entry = cache->hash[hash % TRAPS_CACHE_HASH]; entry; entry = entry->next) {
+		if (entry->hash == hash &&
+		    entry->format == maskFormat->format &&
+		    entry->polyEdge == dst->polyEdge &&
+		    entry->polyMode == dst->polyMode &&
+		    traps_cache_equal(entry, ntrap, traps, dx, dy))
+			break;
+	}
+
+	if (entry == NULL) {
+		DBG(("%s: miss, recording %d traps, hash=%08x\n",
+		     __FUNCTION__, ntrap, hash));
+		cache->misses++;
+		traps_cache_insert(cache, hash, dst, maskFormat, &bounds,
+				   ntrap, traps, dx, dy);
+		return false;
+	}
+
+	list_move(&entry->link, &cache->lru);
+
+	if (entry->mask == NULL) {
+		DBG(("%s: repeat of %d traps, rasterising %dx%d mask\n",
+		     __FUNCTION__, ntrap, entry->width, entry->height));
+		cache->misses++;
+		if (!traps_cache_fill(sna, cache, entry,
+				      dst->pDrawable->pScreen, maskFormat))
+			return false;
+	} else
+		cache->hits++;
+
+	DBG(("%s: using cached %dx%d mask, hits=%lu, misses=%lu\n",
+	     __FUNCTION__, entry->width, entry->height,
+	     cache->hits, cache->misses));
+
+	trapezoid_origin(&traps[0].left, &dst_x, &dst_y);
+	CompositePicture(op, src, entry->mask, dst,
+			 xSrc + bounds.x1 - dst_x,
+			 ySrc + bounds.y1 - dst_y,
+			 0, 0,
+			 bounds.x1, bounds.y1,
+			 entry->width, entry->height);
+	return true;
+}
+
+void sna_traps_cache_fini(struct sna *sna)
+{
+	struct sna_traps_cache *cache = sna->traps_cache;
+
+	if (cache == NULL)
+		return;
+
+	xf86DrvMsgVerb(sna->scrn->scrnIndex, X_INFO, 3,
+		       "Trapezoid mask cache: %lu hits, %lu misses, %lu evictions\n",
+		       cache->hits, cache->misses, cache->evictions);
+
+	while (!list_is_empty(&cache->lru))
+		traps_cache_remove(cache,
+				   list_first_entry(&cache->lru,
+						    struct traps_cache_entry,
+						    link));
+
+	free(cache);
+	sna->traps_cache = NULL;
+}
+
 void
 sna_composite_trapezoids(CARD8 op,
 			 PicturePtr src,
@@ -580,6 +917,9 @@ sna_composite_trapezoids(CARD8 op,
 	if (ntrap == 0)
 		return;
 
+	sna_picture_flush_deferred(src);
+	sna_picture_flush_deferred(dst);
+
 	if (NO_ACCEL)
 		goto force_fallback;
 
@@ -680,6 +1020,10 @@ force_fallback:
 					   ntrap, traps))
 		return;
 
+	if (traps_cache_composite(sna, op, src, dst, maskFormat,
+				  xSrc, ySrc, ntrap, traps))
+		return;
+
 	if (trapezoid_spans_maybe_inplace(sna, op, src, dst, maskFormat)) {
 		flags |= COMPOSITE_SPANS_INPLACE_HINT;
 		if (trapezoid_span_inplace(sna, op, src, dst, maskFormat, flags,
@@ -818,8 +1162,8 @@ trap_upload(PicturePtr picture,
 	return true;
 }
 
-void
-sna_add_traps(PicturePtr picture, INT16 x, INT16 y, int n, xTrap *t)
+static void
+add_traps(PicturePtr picture, INT16 x, INT16 y, int n, xTrap *t)
 {
 	PixmapPtr pixmap = get_drawable_pixmap(picture->pDrawable);
 	struct sna *sna = to_sna_from_pixmap(pixmap);
@@ -857,6 +1201,193 @@ sna_add_traps(PicturePtr picture, INT16 x, INT16 y, int n, xTrap *t)
 	}
 }
 
+/* Clients building up an alpha picture from many small AddTraps requests
+ * would otherwise pay for a migration of the target on every request. So
+ * we queue the traps against the pixmap and rasterise the whole batch in
+ * one pass when the pixmap is next used (or at the latest, before we
+ * sleep in the block handler).
+ */
+#define TRAPS_BATCH_MAX 4096
+
+struct sna_traps {
+	struct list link;
+	struct sna_pixmap *priv;
+	PicturePtr picture;
+	RegionRec clip;
+	unsigned int polyEdge : 1;
+	unsigned int polyMode : 1;
+	int num, size;
+	xTrap *traps;
+};
+
+static void traps_batch_free(struct sna_traps *batch)
+{
+	RegionUninit(&batch->clip);
+	FreePicture(batch->picture, 0);
+	free(batch->traps);
+	free(batch);
+}
+
+void __sna_pixmap_flush_traps(struct sna_pixmap *priv)
+{
+	struct sna_traps *batch = priv->traps;
+	PicturePtr picture = batch->picture;
+	RegionPtr clip = picture->pCompositeClip;
+	unsigned int polyEdge = picture->polyEdge;
+	unsigned int polyMode = picture->polyMode;
+
+	DBG(("%s: pixmap=%ld, %d traps\n", __FUNCTION__,
+	     priv->pixmap->drawable.serialNumber, batch->num));
+	assert(batch->priv == priv);
+
+	/* Detach first so that migrating the target does not recurse */
+	priv->traps = NULL;
+	list_del(&batch->link);
+
+	/* Replay the batch with the picture state it was queued under */
+	picture->pCompositeClip = &batch->clip;
+	picture->polyEdge = batch->polyEdge;
+	picture->polyMode = batch->polyMode;
+
+	add_traps(picture, 0, 0, batch->num, batch->traps);
+
+	picture->pCompositeClip = clip;
+	picture->polyEdge = polyEdge;
+	picture->polyMode = polyMode;
+
+	traps_batch_free(batch);
+}
+
+void sna_traps_flush(struct sna *sna)
+{
+	while (!list_is_empty(&sna->deferred_traps)) {
+		struct sna_traps *batch;
+
+		batch = list_first_entry(&sna->deferred_traps,
+					 struct sna_traps, link);
+		__sna_pixmap_flush_traps(batch->priv);
+	}
+}
+
+static bool traps_batch_compatible(struct sna_traps *batch,
+				   PicturePtr picture)
+{
+	if (batch->picture != picture)
+		return false;
+
+	if (batch->polyEdge != picture->polyEdge ||
+	    batch->polyMode != picture->polyMode)
+		return false;
+
+	return RegionEqual(&batch->clip, picture->pCompositeClip);
+}
+
+static bool
+defer_traps(struct sna *sna, struct sna_pixmap *priv,
+	    PicturePtr picture, INT16 x, INT16 y, int n, xTrap *t)
+{
+	struct sna_traps *batch;
+	xFixed dx, dy;
+	xTrap *dst;
+
+	if (NO_DEFERRED_TRAPS)
+		return false;
+
+	if (picture->pDrawable->type != DRAWABLE_PIXMAP ||
+	    picture->alphaMap)
+		return false;
+
+	if (n > TRAPS_BATCH_MAX)
+		return false;
+
+	batch = priv->traps;
+	if (batch &&
+	    (!traps_batch_compatible(batch, picture) ||
+	     batch->num + n > TRAPS_BATCH_MAX)) {
+		DBG(("%s: flushing incompatible batch of %d traps\n",
+		     __FUNCTION__, batch->num));
+		__sna_pixmap_flush_traps(priv);
+		batch = NULL;
+	}
+
+	if (batch == NULL) {
+		batch = malloc(sizeof(*batch));
+		if (batch == NULL)
+			return false;
+
+		batch->num = batch->size = 0;
+		batch->traps = NULL;
+		batch->priv = priv;
+		batch->picture = picture;
+		batch->polyEdge = picture->polyEdge;
+		batch->polyMode = picture->polyMode;
+		RegionNull(&batch->clip);
+		if (!RegionCopy(&batch->clip, picture->pCompositeClip)) {
+			RegionUninit(&batch->clip);
+			free(batch);
+			return false;
+		}
+
+		/* Keep both the picture and its pixmap alive until replayed */
+		picture->refcnt++;
+		priv->traps = batch;
+		list_add_tail(&batch->link, &sna->deferred_traps);
+	}
+
+	if (batch->num + n > batch->size) {
+		int size = batch->size ? 2 * batch->size : 64;
+		while (size < batch->num + n)
+			size *= 2;
+
+		dst = realloc(batch->traps, size * sizeof(xTrap));
+		if (dst == NULL) {
+			__sna_pixmap_flush_traps(priv);
+			return false;
+		}
+
+		batch->traps = dst;
+		batch->size = size;
+	}
+
+	/* Apply the request origin now so that the batch shares one origin */
+	dx = pixman_int_to_fixed(x);
+	dy = pixman_int_to_fixed(y);
+	dst = batch->traps + batch->num;
+	batch->num += n;
+	do {
+		dst->top.l = t->top.l + dx;
+		dst->top.r = t->top.r + dx;
+		dst->top.y = t->top.y + dy;
+		dst->bot.l = t->bot.l + dx;
+		dst->bot.r = t->bot.r + dx;
+		dst->bot.y = t->bot.y + dy;
+		dst++, t++;
+	} while (--n);
+
+	DBG(("%s: pixmap=%ld, queued %d traps\n", __FUNCTION__,
+	     priv->pixmap->drawable.serialNumber, batch->num));
+	return true;
+}
+
+void
+sna_add_traps(PicturePtr picture, INT16 x, INT16 y, int n, xTrap *t)
+{
+	PixmapPtr pixmap = get_drawable_pixmap(picture->pDrawable);
+	struct sna_pixmap *priv = sna_pixmap(pixmap);
+
+	DBG(("%s (%d, %d) x %d\n", __FUNCTION__, x, y, n));
+
+	if (n <= 0)
+		return;
+
+	if (priv &&
+	    defer_traps(to_sna_from_pixmap(pixmap), priv, picture, x, y, n, t))
+		return;
+
+	sna_pixmap_flush_deferred(priv);
+	add_traps(picture, x, y, n, t);
+}
+
 #if HAS_PIXMAN_TRIANGLES
 static void
 triangles_fallback(CARD8 op,
@@ -964,6 +1495,9 @@ sna_composite_triangles(CARD8 op,
 {
 	struct sna *sna = to_sna_from_drawable(dst->pDrawable);
 
+	sna_picture_flush_deferred(src);
+	sna_picture_flush_deferred(dst);
+
 	if (triangles_span_converter(sna, op, src, dst, maskFormat,
 				     xSrc, ySrc,
 				     n, tri))
@@ -1107,6 +1641,9 @@ sna_composite_tristrip(CARD8 op,
 {
 	struct sna *sna = to_sna_from_drawable(dst->pDrawable);
 
+	sna_picture_flush_deferred(src);
+	sna_picture_flush_deferred(dst);
+
 	if (tristrip_span_converter(sna, op, src, dst, maskFormat, xSrc, ySrc, n, points))
 		return;
 
@@ -1241,6 +1778,14 @@ sna_composite_trifan(CARD8 op,
 		     INT16 xSrc, INT16 ySrc,
 		     int n, xPointFixed *points)
 {
+	struct sna *sna = to_sna_from_drawable(dst->pDrawable);
+
+	sna_picture_flush_deferred(src);
+	sna_picture_flush_deferred(dst);
+
+	if (trifan_span_converter(sna, op, src, dst, maskFormat, xSrc, ySrc, n, points))
+		return;
+
 	trifan_fallback(op, src, dst, maskFormat, xSrc, ySrc, n, points);
 }
 #endif
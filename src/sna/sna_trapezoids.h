@@ -9,9 +9,12 @@
 #define NO_UNALIGNED_BOXES 0
 #define NO_SCAN_CONVERTER 0
 #define NO_GPU_THREADS 0
+#define NO_DEFERRED_TRAPS 0
+#define NO_TRAPS_CACHE 0
 
 #define NO_IMPRECISE 0
 #define NO_PRECISE 0
+#define NO_ANALYTIC 0
 
 #if 0
 #define __DBG DBG
@@ -113,6 +116,19 @@ precise_trapezoid_span_fallback(CARD8 op, PicturePtr src, PicturePtr dst,
 				INT16 src_x, INT16 src_y,
 				int ntrap, xTrapezoid *traps);
 
+bool
+analytic_trapezoid_span_converter(struct sna *sna,
+				  CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, unsigned int flags,
+				  INT16 src_x, INT16 src_y,
+				  int ntrap, xTrapezoid *traps);
+
+bool
+analytic_trapezoid_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, unsigned flags,
+				  INT16 src_x, INT16 src_y,
+				  int ntrap, xTrapezoid *traps);
+
 static inline bool is_mono(PicturePtr dst, PictFormatPtr mask)
 {
 	return mask ? mask->depth < 8 : dst->polyEdge==PolyEdgeSharp;
@@ -123,6 +139,15 @@ static inline bool is_precise(PicturePtr dst, PictFormatPtr mask)
 	return dst->polyMode == PolyModePrecise && !is_mono(dst, mask);
 }
 
+/* The exact area coverage does not land on the sample grid mandated by
+ * PolyModePrecise, so only use it where the client allows an approximation.
+ */
+static inline bool is_analytic(PicturePtr dst, PictFormatPtr mask)
+{
+	return !NO_ANALYTIC &&
+		dst->polyMode == PolyModeImprecise && !is_mono(dst, mask);
+}
+
 static inline bool
 trapezoid_span_inplace(struct sna *sna,
 		       CARD8 op, PicturePtr src, PicturePtr dst,
@@ -169,6 +194,9 @@ trapezoid_span_converter(struct sna *sna,
 		return mono_trapezoids_span_converter(sna, op, src, dst, src_x, src_y, ntrap, traps);
 	else if (is_precise(dst, maskFormat))
 		return precise_trapezoid_span_converter(sna, op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
+	else if (is_analytic(dst, maskFormat) &&
+		 analytic_trapezoid_span_converter(sna, op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps))
+		return true;
 	else
 		return imprecise_trapezoid_span_converter(sna, op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
 }
@@ -184,6 +212,9 @@ trapezoid_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
 
 	if (is_precise(dst, maskFormat))
 		return precise_trapezoid_mask_converter(op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
+	else if (is_analytic(dst, maskFormat) &&
+		 analytic_trapezoid_mask_converter(op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps))
+		return true;
 	else
 		return imprecise_trapezoid_mask_converter(op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
 }
@@ -244,12 +275,6 @@ trap_mask_converter(struct sna *sna,
 		    INT16 x, INT16 y,
 		    int ntrap, xTrap *trap);
 
-bool
-triangles_span_converter(struct sna *sna,
-			 CARD8 op, PicturePtr src, PicturePtr dst,
-			 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
-			 int count, xTriangle *tri);
-
 bool
 triangles_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
 			 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
@@ -271,6 +296,34 @@ precise_tristrip_span_converter(struct sna *sna,
 				PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
 				int count, xPointFixed *points);
 
+bool
+imprecise_triangles_span_converter(struct sna *sna,
+				   CARD8 op, PicturePtr src, PicturePtr dst,
+				   PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				   int count, xTriangle *tri);
+bool
+precise_triangles_span_converter(struct sna *sna,
+				 CARD8 op, PicturePtr src, PicturePtr dst,
+				 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				 int count, xTriangle *tri);
+
+static inline bool
+triangles_span_converter(struct sna *sna,
+			 CARD8 op, PicturePtr src, PicturePtr dst,
+			 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+			 int count, xTriangle *tri)
+{
+	if (NO_SCAN_CONVERTER)
+		return false;
+
+	if (is_mono(dst, maskFormat))
+		return mono_triangles_span_converter(sna, op, src, dst, src_x, src_y, count, tri);
+	else if (is_precise(dst, maskFormat))
+		return precise_triangles_span_converter(sna, op, src, dst, maskFormat, src_x, src_y, count, tri);
+	else
+		return imprecise_triangles_span_converter(sna, op, src, dst, maskFormat, src_x, src_y, count, tri);
+}
+
 static inline bool
 tristrip_span_converter(struct sna *sna,
 			CARD8 op, PicturePtr src, PicturePtr dst,
@@ -288,6 +341,70 @@ tristrip_span_converter(struct sna *sna,
 		return imprecise_tristrip_span_converter(sna, op, src, dst, maskFormat, src_x, src_y, count, points);
 }
 
+bool
+mono_trifan_span_converter(struct sna *sna,
+			   CARD8 op, PicturePtr src, PicturePtr dst,
+			   INT16 src_x, INT16 src_y,
+			   int count, xPointFixed *points);
+bool
+imprecise_trifan_span_converter(struct sna *sna,
+				CARD8 op, PicturePtr src, PicturePtr dst,
+				PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				int count, xPointFixed *points);
+bool
+precise_trifan_span_converter(struct sna *sna,
+			      CARD8 op, PicturePtr src, PicturePtr dst,
+			      PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+			      int count, xPointFixed *points);
+
+/* The converters rasterise a fan by its outline alone, which only
+ * matches compositing each triangle in turn if they all wind the same
+ * way. Otherwise a fold in the fan would cancel its own coverage.
+ */
+static inline bool
+trifan_is_consistent(int count, const xPointFixed *points)
+{
+	int sign = 0, n;
+
+	for (n = 2; n < count; n++) {
+		double cross;
+
+		cross = ((double)points[n-1].x - points[0].x) * ((double)points[n].y - points[0].y) -
+			((double)points[n-1].y - points[0].y) * ((double)points[n].x - points[0].x);
+		if (cross == 0)
+			continue;
+
+		if (sign == 0)
+			sign = cross > 0 ? 1 : -1;
+		else if ((cross > 0) != (sign > 0))
+			return false;
+	}
+
+	return true;
+}
+
+static inline bool
+trifan_span_converter(struct sna *sna,
+		      CARD8 op, PicturePtr src, PicturePtr dst,
+		      PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+		      int count, xPointFixed *points)
+{
+	if (NO_SCAN_CONVERTER)
+		return false;
+
+	if (!trifan_is_consistent(count, points)) {
+		DBG(("%s: fallback -- fan changes orientation\n", __FUNCTION__));
+		return false;
+	}
+
+	if (is_mono(dst, maskFormat))
+		return mono_trifan_span_converter(sna, op, src, dst, src_x, src_y, count, points);
+	else if (is_precise(dst, maskFormat))
+		return precise_trifan_span_converter(sna, op, src, dst, maskFormat, src_x, src_y, count, points);
+	else
+		return imprecise_trifan_span_converter(sna, op, src, dst, maskFormat, src_x, src_y, count, points);
+}
+
 inline static void trapezoid_origin(const xLineFixed *l, int16_t *x, int16_t *y)
 {
 	if (l->p1.y < l->p2.y) {
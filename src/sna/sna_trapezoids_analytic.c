@@ -0,0 +1,1160 @@
+/*
+ * Copyright (c) 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sna.h"
+#include "sna_render.h"
+#include "sna_render_inline.h"
+#include "sna_trapezoids.h"
+#include "fb/fbpict.h"
+
+#include <math.h>
+
+/* An exact area coverage rasteriser.
+ *
+ * Rather than point sampling each pixel on a sub-grid, every edge that
+ * crosses a pixel row deposits the signed area it encloses to its right
+ * into an accumulation buffer (one float per column). A prefix sum along
+ * the row then yields the exact fractional coverage of every pixel, at a
+ * cost of a single pass per pixel row independent of the sampling
+ * precision. Rows where only vertical edges are active produce identical
+ * coverage and are emitted as a single box spanning all those rows.
+ *
+ * As the signed areas are summed, overlapping areas of the same winding
+ * saturate and areas of opposite winding cancel, which is the nonzero
+ * rule for all but sub-pixel self-intersections.
+ */
+
+#ifndef MAX
+#define MAX(x,y) ((x) >= (y) ? (x) : (y))
+#endif
+
+#ifndef MIN
+#define MIN(x,y) ((x) <= (y) ? (x) : (y))
+#endif
+
+#define ALPHA_TO_FLOAT(c) ((c) / 255.f)
+
+typedef void (*span_func_t)(struct sna *sna,
+			    struct sna_composite_spans_op *op,
+			    pixman_region16_t *clip,
+			    const BoxRec *box,
+			    int coverage);
+
+#if HAS_DEBUG_FULL
+static void _assert_pixmap_contains_box(PixmapPtr pixmap, BoxPtr box, const char *function)
+{
+	if (box->x1 < 0 || box->y1 < 0 ||
+	    box->x2 > pixmap->drawable.width ||
+	    box->y2 > pixmap->drawable.height)
+	{
+		FatalError("%s: damage box is beyond the pixmap: box=(%d, %d), (%d, %d), pixmap=(%d, %d)\n",
+			   function,
+			   box->x1, box->y1, box->x2, box->y2,
+			   pixmap->drawable.width,
+			   pixmap->drawable.height);
+	}
+}
+#define assert_pixmap_contains_box(p, b) _assert_pixmap_contains_box(p, b, __FUNCTION__)
+#else
+#define assert_pixmap_contains_box(p, b)
+#endif
+
+static void apply_damage(struct sna_composite_op *op, RegionPtr region)
+{
+	if (op->damage == NULL)
+		return;
+
+	RegionTranslate(region, op->dst.x, op->dst.y);
+
+	assert_pixmap_contains_box(op->dst.pixmap, RegionExtents(region));
+	sna_damage_add(op->damage, region);
+}
+
+static void _apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
+{
+	BoxRec r;
+
+	r.x1 = box->x1 + op->dst.x;
+	r.x2 = box->x2 + op->dst.x;
+	r.y1 = box->y1 + op->dst.y;
+	r.y2 = box->y2 + op->dst.y;
+
+	assert_pixmap_contains_box(op->dst.pixmap, &r);
+	sna_damage_add_box(op->damage, &r);
+}
+
+inline static void apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
+{
+	if (op->damage)
+		_apply_damage_box(op, box);
+}
+
+struct edge {
+	struct edge *next;
+
+	/* All in pixels, relative to the origin of the rasteriser extents */
+	double x, dxdy;
+	double ytop, ybot;
+
+	int dir;
+};
+
+/* A run of columns [x1, x2) that have been written to in the current row */
+struct range {
+	int x1, x2;
+};
+
+struct area {
+	BoxRec extents;
+	int width, height;
+
+	struct edge *edges;
+	int num_edges, max_edges;
+
+	struct edge **y_buckets;
+	struct edge *active;
+
+	struct range *ranges;
+	float *acc;
+
+	struct edge edges_embedded[32];
+	struct range ranges_embedded[32];
+	struct edge *y_buckets_embedded[64];
+	float acc_embedded[256 + 2];
+};
+
+static void
+area_fini(struct area *a)
+{
+	if (a->edges != a->edges_embedded)
+		free(a->edges);
+	if (a->ranges != a->ranges_embedded)
+		free(a->ranges);
+	if (a->y_buckets != a->y_buckets_embedded)
+		free(a->y_buckets);
+	if (a->acc != a->acc_embedded)
+		free(a->acc);
+}
+
+static bool
+area_init(struct area *a, const BoxRec *box, int num_edges)
+{
+	__DBG(("%s: (%d, %d),(%d, %d) x %d\n",
+	       __FUNCTION__, box->x1, box->y1, box->x2, box->y2, num_edges));
+
+	a->extents = *box;
+	a->width = box->x2 - box->x1;
+	a->height = box->y2 - box->y1;
+	assert(a->width > 0 && a->height > 0);
+
+	a->num_edges = 0;
+	a->max_edges = num_edges;
+	a->active = NULL;
+
+	a->edges = a->edges_embedded;
+	a->ranges = a->ranges_embedded;
+	if (num_edges > ARRAY_SIZE(a->edges_embedded)) {
+		a->edges = malloc(sizeof(struct edge)*num_edges);
+		a->ranges = malloc(sizeof(struct range)*num_edges);
+	}
+
+	a->y_buckets = a->y_buckets_embedded;
+	if (a->height > ARRAY_SIZE(a->y_buckets_embedded))
+		a->y_buckets = malloc(sizeof(struct edge *)*a->height);
+
+	/* one column either side for the cell straddling the right edge */
+	a->acc = a->acc_embedded;
+	if (a->width + 2 > ARRAY_SIZE(a->acc_embedded))
+		a->acc = malloc(sizeof(float)*(a->width + 2));
+
+	if (a->edges == NULL || a->ranges == NULL ||
+	    a->y_buckets == NULL || a->acc == NULL) {
+		area_fini(a);
+		return false;
+	}
+
+	memset(a->y_buckets, 0, sizeof(struct edge *)*a->height);
+	memset(a->acc, 0, sizeof(float)*(a->width + 2));
+	return true;
+}
+
+static void
+area_add_edge(struct area *a,
+	      double x1, double y1,
+	      double x2, double y2,
+	      int dir)
+{
+	struct edge *e;
+	double ytop, ybot;
+
+	if (y1 == y2)
+		return;
+
+	if (y2 < y1) {
+		double t;
+
+		t = x1; x1 = x2; x2 = t;
+		t = y1; y1 = y2; y2 = t;
+		dir = -dir;
+	}
+
+	ytop = MAX(y1, 0);
+	ybot = MIN(y2, a->height);
+	if (ybot <= ytop)
+		return;
+
+	assert(a->num_edges < a->max_edges);
+	e = &a->edges[a->num_edges++];
+	e->dxdy = (x2 - x1) / (y2 - y1);
+	e->x = x1 + (ytop - y1) * e->dxdy;
+	e->ytop = ytop;
+	e->ybot = ybot;
+	e->dir = dir;
+
+	e->next = a->y_buckets[(int)ytop];
+	a->y_buckets[(int)ytop] = e;
+}
+
+static void
+area_add_trapezoid_edge(struct area *a,
+			const xLineFixed *l, xFixed top, xFixed bottom,
+			int dir, int dx, int dy)
+{
+	double x1, y1, x2, y2, yt, yb, dxdy;
+
+	y1 = pixman_fixed_to_double(l->p1.y);
+	y2 = pixman_fixed_to_double(l->p2.y);
+	if (y1 == y2)
+		return;
+
+	x1 = pixman_fixed_to_double(l->p1.x);
+	x2 = pixman_fixed_to_double(l->p2.x);
+	dxdy = (x2 - x1) / (y2 - y1);
+
+	/* The trapezoid only uses the line between its top and bottom */
+	yt = pixman_fixed_to_double(top);
+	yb = pixman_fixed_to_double(bottom);
+
+	dx -= a->extents.x1;
+	dy -= a->extents.y1;
+
+	area_add_edge(a,
+		      x1 + (yt - y1) * dxdy + dx, yt + dy,
+		      x1 + (yb - y1) * dxdy + dx, yb + dy,
+		      dir);
+}
+
+static void
+area_add_trapezoid(struct area *a, const xTrapezoid *t, int dx, int dy)
+{
+	if (!xTrapezoidValid(t)) {
+		__DBG(("%s: skipping invalid trapezoid: top=%d, bottom=%d, left=(%d, %d), (%d, %d), right=(%d, %d), (%d, %d)\n",
+		       __FUNCTION__,
+		       t->top, t->bottom,
+		       t->left.p1.x, t->left.p1.y,
+		       t->left.p2.x, t->left.p2.y,
+		       t->right.p1.x, t->right.p1.y,
+		       t->right.p2.x, t->right.p2.y));
+		return;
+	}
+
+	area_add_trapezoid_edge(a, &t->left, t->top, t->bottom, 1, dx, dy);
+	area_add_trapezoid_edge(a, &t->right, t->top, t->bottom, -1, dx, dy);
+}
+
+/* Deposit the signed area to the right of the line x0 -> x1, which
+ * descends through a height of |d| within the current row.
+ */
+static void
+area_accumulate(struct area *a, double x0, double x1, float d)
+{
+	float *acc = a->acc;
+	double x0f, x1c;
+	int x0i, x1i;
+
+	if (x0 > x1) {
+		double t = x0;
+		x0 = x1;
+		x1 = t;
+	}
+
+	/* Lines beyond the left edge fully cover the first column onwards,
+	 * lines beyond the right edge are never seen.
+	 */
+	if (x1 <= 0) {
+		acc[0] += d;
+		return;
+	}
+	if (x0 >= a->width)
+		return;
+
+	if (x0 < 0) {
+		double t = -x0 / (x1 - x0);
+		acc[0] += d * t;
+		d *= 1 - t;
+		x0 = 0;
+	}
+	if (x1 > a->width) {
+		d *= (a->width - x0) / (x1 - x0);
+		x1 = a->width;
+	}
+
+	x0f = floor(x0);
+	x0i = x0f;
+	x1c = ceil(x1);
+	x1i = x1c;
+	assert(x0i >= 0 && x1i <= a->width);
+
+	if (x1i <= x0i + 1) {
+		float xmf = .5 * (x0 + x1) - x0f;
+		acc[x0i] += d - d * xmf;
+		acc[x0i + 1] += d * xmf;
+	} else {
+		double s = 1. / (x1 - x0);
+		double f0 = x0 - x0f;
+		double f1 = x1 - x1c + 1;
+		float a0 = .5 * s * (1 - f0) * (1 - f0);
+		float am = .5 * s * f1 * f1;
+
+		acc[x0i] += d * a0;
+		if (x1i == x0i + 2) {
+			acc[x0i + 1] += d * (1 - a0 - am);
+		} else {
+			float a1 = s * (1.5 - f0);
+			float a2;
+			int x;
+
+			acc[x0i + 1] += d * (a1 - a0);
+			for (x = x0i + 2; x < x1i - 1; x++)
+				acc[x] += d * s;
+			a2 = a1 + (x1i - x0i - 3) * s;
+			acc[x1i - 1] += d * (1 - a2 - am);
+		}
+		acc[x1i] += d * am;
+	}
+}
+
+static force_inline int
+area_to_alpha(float v)
+{
+	v = fabsf(v);
+	if (v >= 1.f)
+		return 255;
+
+	return (int)(v * 255.f + .5f);
+}
+
+struct run {
+	struct sna *sna;
+	struct sna_composite_spans_op *op;
+	pixman_region16_t *clip;
+	span_func_t span;
+	BoxRec box;
+	int alpha;
+	int unbounded;
+};
+
+static force_inline void
+run_emit(struct run *r, int x, int alpha)
+{
+	if (alpha == r->alpha)
+		return;
+
+	r->box.x2 = x;
+	if (r->box.x2 > r->box.x1 && (r->alpha || r->unbounded)) {
+		__DBG(("%s: span (%d, %d)x(%d, %d) @ %d\n", __FUNCTION__,
+		       r->box.x1, r->box.y1,
+		       r->box.x2 - r->box.x1,
+		       r->box.y2 - r->box.y1,
+		       r->alpha));
+		r->span(r->sna, r->op, r->clip, &r->box, r->alpha);
+	}
+
+	r->box.x1 = x;
+	r->alpha = alpha;
+}
+
+static void
+area_blt(struct area *a, struct run *r, int nranges, int y, int height)
+{
+	const int x0 = a->extents.x1;
+	float *acc = a->acc;
+	float cover;
+	int n, m, x;
+
+	/* Columns outside of the touched ranges have the coverage of the
+	 * column to their left, so we only need to walk the ranges.
+	 */
+	for (n = 1; n < nranges; n++) {
+		struct range t = a->ranges[n];
+		for (m = n; m > 0 && a->ranges[m-1].x1 > t.x1; m--)
+			a->ranges[m] = a->ranges[m-1];
+		a->ranges[m] = t;
+	}
+
+	r->box.y1 = a->extents.y1 + y;
+	r->box.y2 = r->box.y1 + height;
+	r->box.x1 = x0;
+	r->alpha = 0;
+
+	cover = 0;
+	x = 0;
+	for (n = 0; n < nranges; n++) {
+		int x1 = a->ranges[n].x1;
+		int x2 = a->ranges[n].x2;
+
+		if (x2 <= x)
+			continue;
+		if (x1 < x)
+			x1 = x;
+
+		run_emit(r, x0 + x1, area_to_alpha(cover));
+		for (x = x1; x < x2; x++) {
+			cover += acc[x];
+			acc[x] = 0;
+			if (x < a->width)
+				run_emit(r, x0 + x, area_to_alpha(cover));
+		}
+	}
+	run_emit(r, x0 + MIN(x, a->width), area_to_alpha(cover));
+
+	/* and close the final run */
+	r->box.x2 = a->extents.x2;
+	if (r->box.x2 > r->box.x1 && (r->alpha || r->unbounded))
+		r->span(r->sna, r->op, r->clip, &r->box, r->alpha);
+}
+
+static int
+area_full_rows(struct area *a, int y)
+{
+	struct edge *e;
+	int limit = a->height;
+	int rows;
+
+	/* With only vertical edges spanning the whole row, every row until
+	 * the next edge starts or stops has the same coverage.
+	 */
+	for (e = a->active; e; e = e->next) {
+		if (e->dxdy != 0 || e->ytop > y)
+			return 1;
+		if (e->ybot < limit)
+			limit = floor(e->ybot);
+	}
+
+	for (rows = 1; y + rows < limit; rows++)
+		if (a->y_buckets[y + rows])
+			break;
+
+	return rows;
+}
+
+static void
+area_render(struct sna *sna,
+	    struct area *a,
+	    struct sna_composite_spans_op *op,
+	    pixman_region16_t *clip,
+	    span_func_t span,
+	    int unbounded)
+{
+	struct run r;
+	int y, h = a->height;
+
+	__DBG(("%s: unbounded=%d\n", __FUNCTION__, unbounded));
+
+	r.sna = sna;
+	r.op = op;
+	r.clip = clip;
+	r.span = span;
+	r.unbounded = unbounded;
+
+	for (y = 0; y < h; ) {
+		struct edge *e, *next, **pe;
+		int rows, nranges;
+
+		for (e = a->y_buckets[y]; e; e = next) {
+			next = e->next;
+			e->next = a->active;
+			a->active = e;
+		}
+
+		if (a->active == NULL) {
+			int j;
+
+			for (j = y + 1; j < h && a->y_buckets[j] == NULL; j++)
+				;
+
+			__DBG(("%s: no edges, skipping %d -> %d\n",
+			       __FUNCTION__, y, j));
+			if (unbounded) {
+				BoxRec box;
+
+				box = a->extents;
+				box.y1 += y;
+				box.y2 = a->extents.y1 + j;
+
+				span(sna, op, clip, &box, 0);
+			}
+
+			y = j;
+			continue;
+		}
+
+		rows = area_full_rows(a, y);
+		assert(rows >= 1 && y + rows <= h);
+
+		nranges = 0;
+		for (pe = &a->active; (e = *pe); ) {
+			double y0 = MAX(e->ytop, y);
+			double y1 = MIN(e->ybot, y + 1);
+			double x0 = e->x + (y0 - e->ytop) * e->dxdy;
+			double x1 = e->x + (y1 - e->ytop) * e->dxdy;
+			struct range *range = &a->ranges[nranges++];
+
+			area_accumulate(a, x0, x1, e->dir * (y1 - y0));
+
+			if (x0 > x1) {
+				double t = x0;
+				x0 = x1;
+				x1 = t;
+			}
+			range->x1 = x1 <= 0 ? 0 : MIN(floor(x0 < 0 ? 0 : x0), a->width);
+			range->x2 = x1 <= 0 ? 1 : MIN(ceil(x1), a->width) + 2;
+			if (range->x2 > a->width + 2)
+				range->x2 = a->width + 2;
+
+			if (e->ybot <= y + rows)
+				*pe = e->next;
+			else
+				pe = &e->next;
+		}
+
+		area_blt(a, &r, nranges, y, rows);
+		y += rows;
+	}
+}
+
+static void
+area_blt_span(struct sna *sna,
+	      struct sna_composite_spans_op *op,
+	      pixman_region16_t *clip,
+	      const BoxRec *box,
+	      int coverage)
+{
+	op->box(sna, op, box, ALPHA_TO_FLOAT(coverage));
+	apply_damage_box(&op->base, box);
+}
+
+static void
+area_blt_span__no_damage(struct sna *sna,
+			 struct sna_composite_spans_op *op,
+			 pixman_region16_t *clip,
+			 const BoxRec *box,
+			 int coverage)
+{
+	op->box(sna, op, box, ALPHA_TO_FLOAT(coverage));
+}
+
+static void
+area_blt_span_clipped(struct sna *sna,
+		      struct sna_composite_spans_op *op,
+		      pixman_region16_t *clip,
+		      const BoxRec *box,
+		      int coverage)
+{
+	pixman_region16_t region;
+
+	pixman_region_init_rects(&region, box, 1);
+	RegionIntersect(&region, &region, clip);
+	if (region_num_rects(&region)) {
+		op->boxes(sna, op,
+			  region_rects(&region),
+			  region_num_rects(&region),
+			  ALPHA_TO_FLOAT(coverage));
+		apply_damage(&op->base, &region);
+	}
+	pixman_region_fini(&region);
+}
+
+static void
+area_blt_mask(struct sna *sna,
+	      struct sna_composite_spans_op *op,
+	      pixman_region16_t *clip,
+	      const BoxRec *box,
+	      int coverage)
+{
+	uint8_t *ptr = (uint8_t *)op;
+	int stride = (intptr_t)clip;
+	int h, w;
+
+	ptr += box->y1 * stride + box->x1;
+
+	h = box->y2 - box->y1;
+	w = box->x2 - box->x1;
+	if ((w | h) == 1) {
+		*ptr = coverage;
+	} else if (w == 1) {
+		do {
+			*ptr = coverage;
+			ptr += stride;
+		} while (--h);
+	} else do {
+		memset(ptr, coverage, w);
+		ptr += stride;
+	} while (--h);
+}
+
+static int operator_is_bounded(uint8_t op)
+{
+	switch (op) {
+	case PictOpOver:
+	case PictOpOutReverse:
+	case PictOpAdd:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static span_func_t
+choose_span(struct sna_composite_spans_op *tmp, RegionPtr clip)
+{
+	if (clip->data)
+		return area_blt_span_clipped;
+	else if (tmp->base.damage == NULL)
+		return area_blt_span__no_damage;
+	else
+		return area_blt_span;
+}
+
+#define SPAN_THREAD_MAX_BOXES (8192/sizeof(struct sna_opacity_box))
+struct span_thread_boxes {
+	const struct sna_composite_spans_op *op;
+	const BoxRec *clip_start, *clip_end;
+	int num_boxes;
+	struct sna_opacity_box boxes[SPAN_THREAD_MAX_BOXES];
+};
+
+static void span_thread_add_box(struct sna *sna, void *data,
+				const BoxRec *box, float alpha)
+{
+	struct span_thread_boxes *b = data;
+
+	if (unlikely(b->num_boxes == SPAN_THREAD_MAX_BOXES)) {
+		DBG(("%s: flushing %d boxes\n", __FUNCTION__, b->num_boxes));
+		b->op->thread_boxes(sna, b->op, b->boxes, b->num_boxes);
+		b->num_boxes = 0;
+	}
+
+	b->boxes[b->num_boxes].box = *box;
+	b->boxes[b->num_boxes].alpha = alpha;
+	b->num_boxes++;
+	assert(b->num_boxes <= SPAN_THREAD_MAX_BOXES);
+}
+
+static void
+span_thread_box(struct sna *sna,
+		struct sna_composite_spans_op *op,
+		pixman_region16_t *clip,
+		const BoxRec *box,
+		int coverage)
+{
+	struct span_thread_boxes *b = (struct span_thread_boxes *)op;
+
+	if (b->num_boxes) {
+		struct sna_opacity_box *bb = &b->boxes[b->num_boxes-1];
+		if (bb->box.x1 == box->x1 &&
+		    bb->box.x2 == box->x2 &&
+		    bb->box.y2 == box->y1 &&
+		    bb->alpha == ALPHA_TO_FLOAT(coverage)) {
+			bb->box.y2 = box->y2;
+			return;
+		}
+	}
+
+	span_thread_add_box(sna, op, box, ALPHA_TO_FLOAT(coverage));
+}
+
+static void
+span_thread_clipped_box(struct sna *sna,
+			struct sna_composite_spans_op *op,
+			pixman_region16_t *clip,
+			const BoxRec *box,
+			int coverage)
+{
+	struct span_thread_boxes *b = (struct span_thread_boxes *)op;
+	const BoxRec *c;
+
+	b->clip_start =
+		find_clip_box_for_y(b->clip_start, b->clip_end, box->y1);
+
+	c = b->clip_start;
+	while (c != b->clip_end) {
+		BoxRec clipped;
+
+		if (box->y2 <= c->y1)
+			break;
+
+		clipped = *box;
+		if (!box_intersect(&clipped, c++))
+			continue;
+
+		span_thread_add_box(sna, op, &clipped, ALPHA_TO_FLOAT(coverage));
+	}
+}
+
+static span_func_t
+thread_choose_span(struct sna_composite_spans_op *tmp, RegionPtr clip)
+{
+	if (tmp->base.damage) {
+		DBG(("%s: damaged -> no thread support\n", __FUNCTION__));
+		return NULL;
+	}
+
+	assert(tmp->thread_boxes);
+	if (clip->data)
+		return span_thread_clipped_box;
+	else
+		return span_thread_box;
+}
+
+struct span_thread {
+	struct sna *sna;
+	const struct sna_composite_spans_op *op;
+	const xTrapezoid *traps;
+	RegionPtr clip;
+	span_func_t span;
+	BoxRec extents;
+	int dx, dy, draw_y;
+	int ntrap;
+	bool unbounded;
+};
+
+static void
+span_thread(void *arg)
+{
+	struct span_thread *thread = arg;
+	struct span_thread_boxes boxes;
+	struct area a;
+	const xTrapezoid *t;
+	int n, y1, y2;
+
+	if (!area_init(&a, &thread->extents, 2*thread->ntrap))
+		return;
+
+	boxes.op = thread->op;
+	boxes.clip_start = region_rects(thread->clip);
+	boxes.clip_end = boxes.clip_start + region_num_rects(thread->clip);
+	boxes.num_boxes = 0;
+
+	y1 = thread->extents.y1 - thread->draw_y;
+	y2 = thread->extents.y2 - thread->draw_y;
+	for (n = thread->ntrap, t = thread->traps; n--; t++) {
+		if (pixman_fixed_integer_floor(t->top) >= y2 ||
+		    pixman_fixed_integer_ceil(t->bottom) <= y1)
+			continue;
+
+		area_add_trapezoid(&a, t, thread->dx, thread->dy);
+	}
+
+	area_render(thread->sna, &a,
+		    (struct sna_composite_spans_op *)&boxes, thread->clip,
+		    thread->span, thread->unbounded);
+
+	area_fini(&a);
+
+	if (boxes.num_boxes) {
+		DBG(("%s: flushing %d boxes\n", __FUNCTION__, boxes.num_boxes));
+		assert(boxes.num_boxes <= SPAN_THREAD_MAX_BOXES);
+		thread->op->thread_boxes(thread->sna, thread->op,
+					 boxes.boxes, boxes.num_boxes);
+	}
+}
+
+bool
+analytic_trapezoid_span_converter(struct sna *sna,
+				  CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, unsigned int flags,
+				  INT16 src_x, INT16 src_y,
+				  int ntrap, xTrapezoid *traps)
+{
+	struct sna_composite_spans_op tmp;
+	pixman_region16_t clip;
+	int16_t dst_x, dst_y;
+	bool was_clear;
+	int dx, dy, n;
+	int num_threads;
+
+	if (NO_ANALYTIC)
+		return false;
+
+	if (!sna->render.check_composite_spans(sna, op, src, dst, 0, 0, flags)) {
+		DBG(("%s: fallback -- composite spans not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	if (!trapezoids_bounds(ntrap, traps, &clip.extents))
+		return true;
+
+	if (((clip.extents.y2 - clip.extents.y1) | (clip.extents.x2 - clip.extents.x1)) < 32) {
+		DBG(("%s: fallback -- traps extents too small %dx%d\n", __FUNCTION__,
+		     clip.extents.y2 - clip.extents.y1,
+		     clip.extents.x2 - clip.extents.x1));
+		return false;
+	}
+
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__,
+	     clip.extents.x1, clip.extents.y1,
+	     clip.extents.x2, clip.extents.y2));
+
+	trapezoid_origin(&traps[0].left, &dst_x, &dst_y);
+
+	if (!sna_compute_composite_region(&clip,
+					  src, NULL, dst,
+					  src_x + clip.extents.x1 - dst_x,
+					  src_y + clip.extents.y1 - dst_y,
+					  0, 0,
+					  clip.extents.x1, clip.extents.y1,
+					  clip.extents.x2 - clip.extents.x1,
+					  clip.extents.y2 - clip.extents.y1)) {
+		DBG(("%s: trapezoids do not intersect drawable clips\n",
+		     __FUNCTION__)) ;
+		return true;
+	}
+
+	if (!sna->render.check_composite_spans(sna, op, src, dst,
+					       clip.extents.x2 - clip.extents.x1,
+					       clip.extents.y2 - clip.extents.y1,
+					       flags)) {
+		DBG(("%s: fallback -- composite spans not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	dx = dst->pDrawable->x;
+	dy = dst->pDrawable->y;
+
+	DBG(("%s: after clip -- extents (%d, %d), (%d, %d), delta=(%d, %d) src -> (%d, %d)\n",
+	     __FUNCTION__,
+	     clip.extents.x1, clip.extents.y1,
+	     clip.extents.x2, clip.extents.y2,
+	     dx, dy,
+	     src_x + clip.extents.x1 - dst_x - dx,
+	     src_y + clip.extents.y1 - dst_y - dy));
+
+	was_clear = sna_drawable_is_clear(dst->pDrawable);
+	switch (op) {
+	case PictOpAdd:
+	case PictOpOver:
+		if (was_clear)
+			op = PictOpSrc;
+		break;
+	case PictOpIn:
+		if (was_clear)
+			return true;
+		break;
+	}
+
+	if (!sna->render.composite_spans(sna, op, src, dst,
+					 src_x + clip.extents.x1 - dst_x - dx,
+					 src_y + clip.extents.y1 - dst_y - dy,
+					 clip.extents.x1,  clip.extents.y1,
+					 clip.extents.x2 - clip.extents.x1,
+					 clip.extents.y2 - clip.extents.y1,
+					 flags, memset(&tmp, 0, sizeof(tmp)))) {
+		DBG(("%s: fallback -- composite spans render op not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	num_threads = 1;
+	if (!NO_GPU_THREADS &&
+	    (flags & COMPOSITE_SPANS_RECTILINEAR) == 0 &&
+	    tmp.thread_boxes &&
+	    thread_choose_span(&tmp, &clip))
+		num_threads = sna_use_threads(clip.extents.x2-clip.extents.x1,
+					      clip.extents.y2-clip.extents.y1,
+					      8);
+	DBG(("%s: using %d threads\n", __FUNCTION__, num_threads));
+	if (num_threads == 1) {
+		struct area a;
+
+		if (!area_init(&a, &clip.extents, 2*ntrap))
+			goto skip;
+
+		for (n = 0; n < ntrap; n++) {
+			if (pixman_fixed_integer_floor(traps[n].top) + dst->pDrawable->y >= clip.extents.y2 ||
+			    pixman_fixed_integer_ceil(traps[n].bottom) + dst->pDrawable->y <= clip.extents.y1)
+				continue;
+
+			area_add_trapezoid(&a, &traps[n], dx, dy);
+		}
+
+		area_render(sna, &a, &tmp, &clip,
+			    choose_span(&tmp, &clip),
+			    !was_clear && maskFormat && !operator_is_bounded(op));
+
+		area_fini(&a);
+	} else {
+		struct span_thread threads[num_threads];
+		int y, h;
+
+		DBG(("%s: using %d threads for span compositing %dx%d\n",
+		     __FUNCTION__, num_threads,
+		     clip.extents.x2 - clip.extents.x1,
+		     clip.extents.y2 - clip.extents.y1));
+
+		threads[0].sna = sna;
+		threads[0].op = &tmp;
+		threads[0].traps = traps;
+		threads[0].ntrap = ntrap;
+		threads[0].extents = clip.extents;
+		threads[0].clip = &clip;
+		threads[0].dx = dx;
+		threads[0].dy = dy;
+		threads[0].draw_y = dst->pDrawable->y;
+		threads[0].unbounded = !was_clear && maskFormat && !operator_is_bounded(op);
+		threads[0].span = thread_choose_span(&tmp, &clip);
+
+		y = clip.extents.y1;
+		h = clip.extents.y2 - clip.extents.y1;
+		h = (h + num_threads - 1) / num_threads;
+		num_threads -= (num_threads-1) * h >= clip.extents.y2 - clip.extents.y1;
+
+		for (n = 1; n < num_threads; n++) {
+			threads[n] = threads[0];
+			threads[n].extents.y1 = y;
+			threads[n].extents.y2 = y += h;
+
+			sna_threads_run(n, span_thread, &threads[n]);
+		}
+
+		assert(y < threads[0].extents.y2);
+		threads[0].extents.y1 = y;
+		span_thread(&threads[0]);
+
+		sna_threads_wait();
+	}
+skip:
+	tmp.done(sna, &tmp);
+
+	REGION_UNINIT(NULL, &clip);
+	return true;
+}
+
+struct mask_thread {
+	PixmapPtr scratch;
+	const xTrapezoid *traps;
+	BoxRec extents;
+	int dx, dy, dst_y;
+	int ntrap;
+};
+
+static void
+mask_thread(void *arg)
+{
+	struct mask_thread *thread = arg;
+	struct area a;
+	const xTrapezoid *t;
+	int n, y1, y2;
+
+	if (!area_init(&a, &thread->extents, 2*thread->ntrap))
+		return;
+
+	y1 = thread->extents.y1 + thread->dst_y;
+	y2 = thread->extents.y2 + thread->dst_y;
+	for (n = thread->ntrap, t = thread->traps; n--; t++) {
+		if (pixman_fixed_integer_floor(t->top) >= y2 ||
+		    pixman_fixed_integer_ceil(t->bottom) <= y1)
+			continue;
+
+		area_add_trapezoid(&a, t, thread->dx, thread->dy);
+	}
+
+	area_render(NULL, &a,
+		    thread->scratch->devPrivate.ptr,
+		    (void *)(intptr_t)thread->scratch->devKind,
+		    area_blt_mask, true);
+
+	area_fini(&a);
+}
+
+bool
+analytic_trapezoid_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, unsigned flags,
+				  INT16 src_x, INT16 src_y,
+				  int ntrap, xTrapezoid *traps)
+{
+	ScreenPtr screen = dst->pDrawable->pScreen;
+	PixmapPtr scratch;
+	PicturePtr mask;
+	BoxRec extents;
+	int num_threads;
+	int16_t dst_x, dst_y;
+	int dx, dy;
+	int error, n;
+
+	if (NO_ANALYTIC)
+		return false;
+
+	if (maskFormat == NULL && ntrap > 1) {
+		DBG(("%s: individual rasterisation requested\n",
+		     __FUNCTION__));
+		do {
+			/* XXX unwind errors? */
+			if (!analytic_trapezoid_mask_converter(op, src, dst, NULL, flags,
+							       src_x, src_y, 1, traps++))
+				return false;
+		} while (--ntrap);
+		return true;
+	}
+
+	if (!trapezoids_bounds(ntrap, traps, &extents))
+		return true;
+
+	DBG(("%s: ntraps=%d, extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, ntrap, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	if (!sna_compute_composite_extents(&extents,
+					   src, NULL, dst,
+					   src_x, src_y,
+					   0, 0,
+					   extents.x1, extents.y1,
+					   extents.x2 - extents.x1,
+					   extents.y2 - extents.y1))
+		return true;
+
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	extents.y2 -= extents.y1;
+	extents.x2 -= extents.x1;
+	extents.x1 -= dst->pDrawable->x;
+	extents.y1 -= dst->pDrawable->y;
+	dst_x = extents.x1;
+	dst_y = extents.y1;
+	dx = -extents.x1;
+	dy = -extents.y1;
+	extents.x1 = extents.y1 = 0;
+
+	DBG(("%s: mask (%dx%d), dx=(%d, %d)\n",
+	     __FUNCTION__, extents.x2, extents.y2, dx, dy));
+	scratch = sna_pixmap_create_upload(screen,
+					   extents.x2, extents.y2, 8,
+					   KGEM_BUFFER_WRITE_INPLACE);
+	if (!scratch)
+		return true;
+
+	DBG(("%s: created buffer %p, stride %d\n",
+	     __FUNCTION__, scratch->devPrivate.ptr, scratch->devKind));
+
+	num_threads = 1;
+	if (!NO_GPU_THREADS &&
+	    (flags & COMPOSITE_SPANS_RECTILINEAR) == 0)
+		num_threads = sna_use_threads(extents.x2 - extents.x1,
+					      extents.y2 - extents.y1,
+					      4);
+	if (num_threads == 1) {
+		struct area a;
+
+		if (!area_init(&a, &extents, 2*ntrap)) {
+			sna_pixmap_destroy(scratch);
+			return true;
+		}
+
+		for (n = 0; n < ntrap; n++) {
+			if (pixman_fixed_to_int(traps[n].top) - dst_y >= extents.y2 ||
+			    pixman_fixed_to_int(traps[n].bottom) - dst_y < 0)
+				continue;
+
+			area_add_trapezoid(&a, &traps[n], dx, dy);
+		}
+
+		area_render(NULL, &a,
+			    scratch->devPrivate.ptr,
+			    (void *)(intptr_t)scratch->devKind,
+			    area_blt_mask, true);
+		area_fini(&a);
+	} else {
+		struct mask_thread threads[num_threads];
+		int y, h;
+
+		DBG(("%s: using %d threads for mask compositing %dx%d\n",
+		     __FUNCTION__, num_threads,
+		     extents.x2 - extents.x1,
+		     extents.y2 - extents.y1));
+
+		threads[0].scratch = scratch;
+		threads[0].traps = traps;
+		threads[0].ntrap = ntrap;
+		threads[0].extents = extents;
+		threads[0].dx = dx;
+		threads[0].dy = dy;
+		threads[0].dst_y = dst_y;
+
+		y = extents.y1;
+		h = extents.y2 - extents.y1;
+		h = (h + num_threads - 1) / num_threads;
+		num_threads -= (num_threads-1) * h >= extents.y2 - extents.y1;
+
+		for (n = 1; n < num_threads; n++) {
+			threads[n] = threads[0];
+			threads[n].extents.y1 = y;
+			threads[n].extents.y2 = y += h;
+
+			sna_threads_run(n, mask_thread, &threads[n]);
+		}
+
+		assert(y < threads[0].extents.y2);
+		threads[0].extents.y1 = y;
+		mask_thread(&threads[0]);
+
+		sna_threads_wait();
+	}
+
+	mask = CreatePicture(0, &scratch->drawable,
+			     PictureMatchFormat(screen, 8, PICT_a8),
+			     0, 0, serverClient, &error);
+	if (mask) {
+		int16_t x0, y0;
+
+		trapezoid_origin(&traps[0].left, &x0, &y0);
+
+		CompositePicture(op, src, mask, dst,
+				 src_x + dst_x - x0,
+				 src_y + dst_y - y0,
+				 0, 0,
+				 dst_x, dst_y,
+				 extents.x2, extents.y2);
+		FreePicture(mask, 0);
+	}
+	sna_pixmap_destroy(scratch);
+
+	return true;
+}
@@ -3404,132 +3404,6 @@ trap_mask_converter(struct sna *sna,
 	return true;
 }
 
-bool
-triangles_span_converter(struct sna *sna,
-			 CARD8 op, PicturePtr src, PicturePtr dst,
-			 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
-			 int count, xTriangle *tri)
-{
-	struct sna_composite_spans_op tmp;
-	struct tor tor;
-	BoxRec extents;
-	pixman_region16_t clip;
-	int16_t dst_x, dst_y;
-	int dx, dy, n;
-	bool was_clear;
-
-	if (NO_SCAN_CONVERTER)
-		return false;
-
-	if (is_mono(dst, maskFormat))
-		return mono_triangles_span_converter(sna, op, src, dst,
-						     src_x, src_y,
-						     count, tri);
-
-	/* XXX strict adherence to the Render specification */
-	if (dst->polyMode == PolyModePrecise) {
-		DBG(("%s: fallback -- precise rasterisation requested\n",
-		     __FUNCTION__));
-		return false;
-	}
-
-	if (!sna->render.check_composite_spans(sna, op, src, dst, 0, 0, 0)) {
-		DBG(("%s: fallback -- composite spans not supported\n",
-		     __FUNCTION__));
-		return false;
-	}
-
-	dst_x = pixman_fixed_to_int(tri[0].p1.x);
-	dst_y = pixman_fixed_to_int(tri[0].p1.y);
-
-	miTriangleBounds(count, tri, &extents);
-	DBG(("%s: extents (%d, %d), (%d, %d)\n",
-	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
-
-	if (extents.y1 >= extents.y2 || extents.x1 >= extents.x2)
-		return true;
-
-#if 0
-	if (extents.y2 - extents.y1 < 64 && extents.x2 - extents.x1 < 64) {
-		DBG(("%s: fallback -- traps extents too small %dx%d\n",
-		     __FUNCTION__, extents.y2 - extents.y1, extents.x2 - extents.x1));
-		return false;
-	}
-#endif
-
-	if (!sna_compute_composite_region(&clip,
-					  src, NULL, dst,
-					  src_x + extents.x1 - dst_x,
-					  src_y + extents.y1 - dst_y,
-					  0, 0,
-					  extents.x1, extents.y1,
-					  extents.x2 - extents.x1,
-					  extents.y2 - extents.y1)) {
-		DBG(("%s: triangles do not intersect drawable clips\n",
-		     __FUNCTION__)) ;
-		return true;
-	}
-
-	if (!sna->render.check_composite_spans(sna, op, src, dst,
-					       clip.extents.x2 - clip.extents.x1,
-					       clip.extents.y2 - clip.extents.y1,
-					       0)) {
-		DBG(("%s: fallback -- composite spans not supported\n",
-		     __FUNCTION__));
-		return false;
-	}
-
-	extents = *RegionExtents(&clip);
-	dx = dst->pDrawable->x;
-	dy = dst->pDrawable->y;
-
-	DBG(("%s: after clip -- extents (%d, %d), (%d, %d), delta=(%d, %d) src -> (%d, %d)\n",
-	     __FUNCTION__,
-	     extents.x1, extents.y1,
-	     extents.x2, extents.y2,
-	     dx, dy,
-	     src_x + extents.x1 - dst_x - dx,
-	     src_y + extents.y1 - dst_y - dy));
-
-	was_clear = sna_drawable_is_clear(dst->pDrawable);
-
-	memset(&tmp, 0, sizeof(tmp));
-	if (!sna->render.composite_spans(sna, op, src, dst,
-					 src_x + extents.x1 - dst_x - dx,
-					 src_y + extents.y1 - dst_y - dy,
-					 extents.x1,  extents.y1,
-					 extents.x2 - extents.x1,
-					 extents.y2 - extents.y1,
-					 0,
-					 &tmp)) {
-		DBG(("%s: fallback -- composite spans render op not supported\n",
-		     __FUNCTION__));
-		return false;
-	}
-
-	dx *= FAST_SAMPLES_X;
-	dy *= FAST_SAMPLES_Y;
-	if (!tor_init(&tor, &extents, 3*count))
-		goto skip;
-
-	for (n = 0; n < count; n++) {
-		polygon_add_line(tor.polygon, &tri[n].p1, &tri[n].p2, dx, dy);
-		polygon_add_line(tor.polygon, &tri[n].p2, &tri[n].p3, dx, dy);
-		polygon_add_line(tor.polygon, &tri[n].p3, &tri[n].p1, dx, dy);
-	}
-
-	tor_render(sna, &tor, &tmp, &clip,
-		   choose_span(&tmp, dst, maskFormat, &clip),
-		   !was_clear && maskFormat && !operator_is_bounded(op));
-
-	tor_fini(&tor);
-skip:
-	tmp.done(sna, &tmp);
-
-	REGION_UNINIT(NULL, &clip);
-	return true;
-}
-
 bool
 triangles_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
 			 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
@@ -3643,55 +3517,92 @@ triangles_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
 	return true;
 }
 
-struct tristrip_thread {
+typedef void (*points_edges_func_t)(struct polygon *polygon,
+				    const xPointFixed *points, int count,
+				    int dx, int dy);
+
+static void
+tristrip_add_edges(struct polygon *polygon,
+		   const xPointFixed *points, int count,
+		   int dx, int dy)
+{
+	int n, cw, ccw;
+
+	cw = 0; ccw = 1;
+	polygon_add_line(polygon, &points[ccw], &points[cw], dx, dy);
+	n = 2;
+	do {
+		polygon_add_line(polygon, &points[cw], &points[n], dx, dy);
+		cw = n;
+		if (++n == count)
+			break;
+
+		polygon_add_line(polygon, &points[n], &points[ccw], dx, dy);
+		ccw = n;
+		if (++n == count)
+			break;
+	} while (1);
+	polygon_add_line(polygon, &points[cw], &points[ccw], dx, dy);
+}
+
+static void
+triangles_add_edges(struct polygon *polygon,
+		    const xPointFixed *points, int count,
+		    int dx, int dy)
+{
+	int n;
+
+	for (n = 0; n < count; n += 3) {
+		polygon_add_line(polygon, &points[n+0], &points[n+1], dx, dy);
+		polygon_add_line(polygon, &points[n+1], &points[n+2], dx, dy);
+		polygon_add_line(polygon, &points[n+2], &points[n+0], dx, dy);
+	}
+}
+
+static void
+trifan_add_edges(struct polygon *polygon,
+		 const xPointFixed *points, int count,
+		 int dx, int dy)
+{
+	int n;
+
+	/* The shared spokes of a fan cancel, leaving just the outline;
+	 * trifan_is_consistent() has checked that its winding is uniform.
+	 */
+	for (n = 1; n < count; n++)
+		polygon_add_line(polygon, &points[n-1], &points[n], dx, dy);
+	polygon_add_line(polygon, &points[count-1], &points[0], dx, dy);
+}
+
+struct points_thread {
 	struct sna *sna;
 	const struct sna_composite_spans_op *op;
 	const xPointFixed *points;
+	points_edges_func_t add_edges;
 	RegionPtr clip;
 	span_func_t span;
 	BoxRec extents;
 	int dx, dy, draw_y;
-	int count;
+	int count, num_edges;
 	bool unbounded;
 };
 
 static void
-tristrip_thread(void *arg)
+points_thread(void *arg)
 {
-	struct tristrip_thread *thread = arg;
+	struct points_thread *thread = arg;
 	struct span_thread_boxes boxes;
 	struct tor tor;
-	int n, cw, ccw;
 
-	if (!tor_init(&tor, &thread->extents, 2*thread->count))
+	if (!tor_init(&tor, &thread->extents, thread->num_edges))
 		return;
 
 	span_thread_boxes_init(&boxes, thread->op, thread->clip);
 
-	cw = 0; ccw = 1;
-	polygon_add_line(tor.polygon,
-			 &thread->points[ccw], &thread->points[cw],
-			 thread->dx, thread->dy);
-	n = 2;
-	do {
-		polygon_add_line(tor.polygon,
-				 &thread->points[cw], &thread->points[n],
-				 thread->dx, thread->dy);
-		cw = n;
-		if (++n == thread->count)
-			break;
-
-		polygon_add_line(tor.polygon,
-				 &thread->points[n], &thread->points[ccw],
-				 thread->dx, thread->dy);
-		ccw = n;
-		if (++n == thread->count)
-			break;
-	} while (1);
-	polygon_add_line(tor.polygon,
-			 &thread->points[cw], &thread->points[ccw],
-			 thread->dx, thread->dy);
-	assert(tor.polygon->num_edges <= 2*thread->count);
+	thread->add_edges(tor.polygon,
+			  thread->points, thread->count,
+			  thread->dx, thread->dy);
+	assert(tor.polygon->num_edges <= thread->num_edges);
 
 	tor_render(thread->sna, &tor,
 		   (struct sna_composite_spans_op *)&boxes, thread->clip,
@@ -3707,11 +3618,12 @@ tristrip_thread(void *arg)
 	}
 }
 
-bool
-imprecise_tristrip_span_converter(struct sna *sna,
-				  CARD8 op, PicturePtr src, PicturePtr dst,
-				  PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
-				  int count, xPointFixed *points)
+static bool
+points_span_converter(struct sna *sna,
+		      CARD8 op, PicturePtr src, PicturePtr dst,
+		      PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+		      const xPointFixed *points, int count,
+		      points_edges_func_t add_edges, int num_edges)
 {
 	struct sna_composite_spans_op tmp;
 	BoxRec extents;
@@ -3729,21 +3641,13 @@ imprecise_tristrip_span_converter(struct sna *sna,
 	dst_x = pixman_fixed_to_int(points[0].x);
 	dst_y = pixman_fixed_to_int(points[0].y);
 
-	miPointFixedBounds(count, points, &extents);
+	miPointFixedBounds(count, (xPointFixed *)points, &extents);
 	DBG(("%s: extents (%d, %d), (%d, %d)\n",
 	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
 
 	if (extents.y1 >= extents.y2 || extents.x1 >= extents.x2)
 		return true;
 
-#if 0
-	if (extents.y2 - extents.y1 < 64 && extents.x2 - extents.x1 < 64) {
-		DBG(("%s: fallback -- traps extents too small %dx%d\n",
-		     __FUNCTION__, extents.y2 - extents.y1, extents.x2 - extents.x1));
-		return false;
-	}
-#endif
-
 	if (!sna_compute_composite_region(&clip,
 					  src, NULL, dst,
 					  src_x + extents.x1 - dst_x,
@@ -3806,35 +3710,12 @@ imprecise_tristrip_span_converter(struct sna *sna,
 					      16);
 	if (num_threads == 1) {
 		struct tor tor;
-		int cw, ccw, n;
 
-		if (!tor_init(&tor, &extents, 2*count))
+		if (!tor_init(&tor, &extents, num_edges))
 			goto skip;
 
-		cw = 0; ccw = 1;
-		polygon_add_line(tor.polygon,
-				 &points[ccw], &points[cw],
-				 dx, dy);
-		n = 2;
-		do {
-			polygon_add_line(tor.polygon,
-					 &points[cw], &points[n],
-					 dx, dy);
-			cw = n;
-			if (++n == count)
-				break;
-
-			polygon_add_line(tor.polygon,
-					 &points[n], &points[ccw],
-					 dx, dy);
-			ccw = n;
-			if (++n == count)
-				break;
-		} while (1);
-		polygon_add_line(tor.polygon,
-				 &points[cw], &points[ccw],
-				 dx, dy);
-		assert(tor.polygon->num_edges <= 2*count);
+		add_edges(tor.polygon, points, count, dx, dy);
+		assert(tor.polygon->num_edges <= num_edges);
 
 		tor_render(sna, &tor, &tmp, &clip,
 			   choose_span(&tmp, dst, maskFormat, &clip),
@@ -3842,10 +3723,10 @@ imprecise_tristrip_span_converter(struct sna *sna,
 
 		tor_fini(&tor);
 	} else {
-		struct tristrip_thread threads[num_threads];
+		struct points_thread threads[num_threads];
 		int y, h, n;
 
-		DBG(("%s: using %d threads for tristrip compositing %dx%d\n",
+		DBG(("%s: using %d threads for triangle compositing %dx%d\n",
 		     __FUNCTION__, num_threads,
 		     clip.extents.x2 - clip.extents.x1,
 		     clip.extents.y2 - clip.extents.y1));
@@ -3854,6 +3735,8 @@ imprecise_tristrip_span_converter(struct sna *sna,
 		threads[0].op = &tmp;
 		threads[0].points = points;
 		threads[0].count = count;
+		threads[0].add_edges = add_edges;
+		threads[0].num_edges = num_edges;
 		threads[0].extents = clip.extents;
 		threads[0].clip = &clip;
 		threads[0].dx = dx;
@@ -3872,12 +3755,12 @@ imprecise_tristrip_span_converter(struct sna *sna,
 			threads[n].extents.y1 = y;
 			threads[n].extents.y2 = y += h;
 
-			sna_threads_run(n, tristrip_thread, &threads[n]);
+			sna_threads_run(n, points_thread, &threads[n]);
 		}
 
 		assert(y < threads[0].extents.y2);
 		threads[0].extents.y1 = y;
-		tristrip_thread(&threads[0]);
+		points_thread(&threads[0]);
 
 		sna_threads_wait();
 	}
@@ -3887,3 +3770,39 @@ skip:
 	REGION_UNINIT(NULL, &clip);
 	return true;
 }
+
+bool
+imprecise_tristrip_span_converter(struct sna *sna,
+				  CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				  int count, xPointFixed *points)
+{
+	return points_span_converter(sna, op, src, dst, maskFormat,
+				     src_x, src_y,
+				     points, count,
+				     tristrip_add_edges, 2*count);
+}
+
+bool
+imprecise_triangles_span_converter(struct sna *sna,
+				   CARD8 op, PicturePtr src, PicturePtr dst,
+				   PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				   int count, xTriangle *tri)
+{
+	return points_span_converter(sna, op, src, dst, maskFormat,
+				     src_x, src_y,
+				     (xPointFixed *)tri, 3*count,
+				     triangles_add_edges, 3*count);
+}
+
+bool
+imprecise_trifan_span_converter(struct sna *sna,
+				CARD8 op, PicturePtr src, PicturePtr dst,
+				PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				int count, xPointFixed *points)
+{
+	return points_span_converter(sna, op, src, dst, maskFormat,
+				     src_x, src_y,
+				     points, count,
+				     trifan_add_edges, count);
+}
@@ -3248,55 +3248,92 @@ precise_trapezoid_span_fallback(CARD8 op, PicturePtr src, PicturePtr dst,
 	return true;
 }
 
-struct tristrip_thread {
+typedef void (*points_edges_func_t)(struct polygon *polygon,
+				    const xPointFixed *points, int count,
+				    int dx, int dy);
+
+static void
+tristrip_add_edges(struct polygon *polygon,
+		   const xPointFixed *points, int count,
+		   int dx, int dy)
+{
+	int n, cw, ccw;
+
+	cw = 0; ccw = 1;
+	polygon_add_line(polygon, &points[ccw], &points[cw], dx, dy);
+	n = 2;
+	do {
+		polygon_add_line(polygon, &points[cw], &points[n], dx, dy);
+		cw = n;
+		if (++n == count)
+			break;
+
+		polygon_add_line(polygon, &points[n], &points[ccw], dx, dy);
+		ccw = n;
+		if (++n == count)
+			break;
+	} while (1);
+	polygon_add_line(polygon, &points[cw], &points[ccw], dx, dy);
+}
+
+static void
+triangles_add_edges(struct polygon *polygon,
+		    const xPointFixed *points, int count,
+		    int dx, int dy)
+{
+	int n;
+
+	for (n = 0; n < count; n += 3) {
+		polygon_add_line(polygon, &points[n+0], &points[n+1], dx, dy);
+		polygon_add_line(polygon, &points[n+1], &points[n+2], dx, dy);
+		polygon_add_line(polygon, &points[n+2], &points[n+0], dx, dy);
+	}
+}
+
+static void
+trifan_add_edges(struct polygon *polygon,
+		 const xPointFixed *points, int count,
+		 int dx, int dy)
+{
+	int n;
+
+	/* The shared spokes of a fan cancel, leaving just the outline;
+	 * trifan_is_consistent() has checked that its winding is uniform.
+	 */
+	for (n = 1; n < count; n++)
+		polygon_add_line(polygon, &points[n-1], &points[n], dx, dy);
+	polygon_add_line(polygon, &points[count-1], &points[0], dx, dy);
+}
+
+struct points_thread {
 	struct sna *sna;
 	const struct sna_composite_spans_op *op;
 	const xPointFixed *points;
+	points_edges_func_t add_edges;
 	RegionPtr clip;
 	span_func_t span;
 	BoxRec extents;
 	int dx, dy, draw_y;
-	int count;
+	int count, num_edges;
 	bool unbounded;
 };
 
 static void
-tristrip_thread(void *arg)
+points_thread(void *arg)
 {
-	struct tristrip_thread *thread = arg;
+	struct points_thread *thread = arg;
 	struct span_thread_boxes boxes;
 	struct tor tor;
-	int n, cw, ccw;
 
-	if (!tor_init(&tor, &thread->extents, 2*thread->count))
+	if (!tor_init(&tor, &thread->extents, thread->num_edges))
 		return;
 
 	span_thread_boxes_init(&boxes, thread->op, thread->clip);
 
-	cw = 0; ccw = 1;
-	polygon_add_line(tor.polygon,
-			 &thread->points[ccw], &thread->points[cw],
-			 thread->dx, thread->dy);
-	n = 2;
-	do {
-		polygon_add_line(tor.polygon,
-				 &thread->points[cw], &thread->points[n],
-				 thread->dx, thread->dy);
-		cw = n;
-		if (++n == thread->count)
-			break;
-
-		polygon_add_line(tor.polygon,
-				 &thread->points[n], &thread->points[ccw],
-				 thread->dx, thread->dy);
-		ccw = n;
-		if (++n == thread->count)
-			break;
-	} while (1);
-	polygon_add_line(tor.polygon,
-			 &thread->points[cw], &thread->points[ccw],
-			 thread->dx, thread->dy);
-	assert(tor.polygon->num_edges <= 2*thread->count);
+	thread->add_edges(tor.polygon,
+			  thread->points, thread->count,
+			  thread->dx, thread->dy);
+	assert(tor.polygon->num_edges <= thread->num_edges);
 
 	tor_render(thread->sna, &tor,
 		   (struct sna_composite_spans_op *)&boxes, thread->clip,
@@ -3312,11 +3349,12 @@ tristrip_thread(void *arg)
 	}
 }
 
-bool
-precise_tristrip_span_converter(struct sna *sna,
-				CARD8 op, PicturePtr src, PicturePtr dst,
-				PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
-				int count, xPointFixed *points)
+static bool
+points_span_converter(struct sna *sna,
+		      CARD8 op, PicturePtr src, PicturePtr dst,
+		      PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+		      const xPointFixed *points, int count,
+		      points_edges_func_t add_edges, int num_edges)
 {
 	struct sna_composite_spans_op tmp;
 	BoxRec extents;
@@ -3334,21 +3372,13 @@ precise_tristrip_span_converter(struct sna *sna,
 	dst_x = pixman_fixed_to_int(points[0].x);
 	dst_y = pixman_fixed_to_int(points[0].y);
 
-	miPointFixedBounds(count, points, &extents);
+	miPointFixedBounds(count, (xPointFixed *)points, &extents);
 	DBG(("%s: extents (%d, %d), (%d, %d)\n",
 	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
 
 	if (extents.y1 >= extents.y2 || extents.x1 >= extents.x2)
 		return true;
 
-#if 0
-	if (extents.y2 - extents.y1 < 64 && extents.x2 - extents.x1 < 64) {
-		DBG(("%s: fallback -- traps extents too small %dx%d\n",
-		     __FUNCTION__, extents.y2 - extents.y1, extents.x2 - extents.x1));
-		return false;
-	}
-#endif
-
 	if (!sna_compute_composite_region(&clip,
 					  src, NULL, dst,
 					  src_x + extents.x1 - dst_x,
@@ -3411,35 +3441,12 @@ precise_tristrip_span_converter(struct sna *sna,
 					      16);
 	if (num_threads == 1) {
 		struct tor tor;
-		int cw, ccw, n;
 
-		if (!tor_init(&tor, &extents, 2*count))
+		if (!tor_init(&tor, &extents, num_edges))
 			goto skip;
 
-		cw = 0; ccw = 1;
-		polygon_add_line(tor.polygon,
-				 &points[ccw], &points[cw],
-				 dx, dy);
-		n = 2;
-		do {
-			polygon_add_line(tor.polygon,
-					 &points[cw], &points[n],
-					 dx, dy);
-			cw = n;
-			if (++n == count)
-				break;
-
-			polygon_add_line(tor.polygon,
-					 &points[n], &points[ccw],
-					 dx, dy);
-			ccw = n;
-			if (++n == count)
-				break;
-		} while (1);
-		polygon_add_line(tor.polygon,
-				 &points[cw], &points[ccw],
-				 dx, dy);
-		assert(tor.polygon->num_edges <= 2*count);
+		add_edges(tor.polygon, points, count, dx, dy);
+		assert(tor.polygon->num_edges <= num_edges);
 
 		tor_render(sna, &tor, &tmp, &clip,
 			   choose_span(&tmp, dst, maskFormat, &clip),
@@ -3447,10 +3454,10 @@ precise_tristrip_span_converter(struct sna *sna,
 
 		tor_fini(&tor);
 	} else {
-		struct tristrip_thread threads[num_threads];
+		struct points_thread threads[num_threads];
 		int y, h, n;
 
-		DBG(("%s: using %d threads for tristrip compositing %dx%d\n",
+		DBG(("%s: using %d threads for triangle compositing %dx%d\n",
 		     __FUNCTION__, num_threads,
 		     clip.extents.x2 - clip.extents.x1,
 		     clip.extents.y2 - clip.extents.y1));
@@ -3459,6 +3466,8 @@ precise_tristrip_span_converter(struct sna *sna,
 		threads[0].op = &tmp;
 		threads[0].points = points;
 		threads[0].count = count;
+		threads[0].add_edges = add_edges;
+		threads[0].num_edges = num_edges;
 		threads[0].extents = clip.extents;
 		threads[0].clip = &clip;
 		threads[0].dx = dx;
@@ -3477,12 +3486,12 @@ precise_tristrip_span_converter(struct sna *sna,
 			threads[n].extents.y1 = y;
 			threads[n].extents.y2 = y += h;
 
-			sna_threads_run(n, tristrip_thread, &threads[n]);
+			sna_threads_run(n, points_thread, &threads[n]);
 		}
 
 		assert(y < threads[0].extents.y2);
 		threads[0].extents.y1 = y;
-		tristrip_thread(&threads[0]);
+		points_thread(&threads[0]);
 
 		sna_threads_wait();
 	}
@@ -3493,6 +3502,42 @@ skip:
 	return true;
 }
 
+bool
+precise_tristrip_span_converter(struct sna *sna,
+				CARD8 op, PicturePtr src, PicturePtr dst,
+				PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				int count, xPointFixed *points)
+{
+	return points_span_converter(sna, op, src, dst, maskFormat,
+				     src_x, src_y,
+				     points, count,
+				     tristrip_add_edges, 2*count);
+}
+
+bool
+precise_triangles_span_converter(struct sna *sna,
+				 CARD8 op, PicturePtr src, PicturePtr dst,
+				 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				 int count, xTriangle *tri)
+{
+	return points_span_converter(sna, op, src, dst, maskFormat,
+				     src_x, src_y,
+				     (xPointFixed *)tri, 3*count,
+				     triangles_add_edges, 3*count);
+}
+
+bool
+precise_trifan_span_converter(struct sna *sna,
+			      CARD8 op, PicturePtr src, PicturePtr dst,
+			      PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+			      int count, xPointFixed *points)
+{
+	return points_span_converter(sna, op, src, dst, maskFormat,
+				     src_x, src_y,
+				     points, count,
+				     trifan_add_edges, count);
+}
+
 bool
 precise_trap_span_converter(struct sna *sna,
 			    PicturePtr dst,
@@ -58,6 +58,8 @@
 
 #include "intel_options.h"
 
+#define USE_USERPTR_VIDEO 1
+
 #include <xf86xv.h>
 
 #ifdef SNA_XVMC
@@ -74,6 +76,9 @@ void sna_video_free_buffers(struct sna_video *video)
 {
 	unsigned int i;
 
+	DBG(("%s: frames=%lu, late=%lu, dropped=%lu\n", __FUNCTION__,
+	     video->stats.frames, video->stats.late, video->stats.dropped));
+
 	for (i = 0; i < ARRAY_SIZE(video->old_buf); i++) {
 		if (video->old_buf[i]) {
 			kgem_bo_destroy(&video->sna->kgem, video->old_buf[i]);
@@ -102,6 +107,38 @@ sna_video_buffer(struct sna_video *video,
 			sna_video_free_buffers(video);
 	}
 
+	/* Rather than stall on a buffer the GPU is still reading,
+	 * pick the oldest idle buffer from the ring (but never the
+	 * frame currently being shown) or allocate a fresh one.
+	 */
+	video->stats.frames++;
+	if (video->buf && kgem_bo_is_busy(video->buf)) {
+		int i;
+
+		video->stats.late++;
+		for (i = video->sna->xv.num_buffers - 2; i > 0; i--) {
+			struct kgem_bo *bo = video->old_buf[i];
+
+			if (bo == NULL || kgem_bo_is_busy(bo))
+				continue;
+
+			if (__kgem_bo_size(bo) < frame->size)
+				continue;
+
+			DBG(("%s: swapping busy handle=%d for idle handle=%d\n",
+			     __FUNCTION__, video->buf->handle, bo->handle));
+			video->old_buf[i] = video->buf;
+			video->buf = bo;
+			break;
+		}
+		if (i == 0) {
+			DBG(("%s: all buffers busy, replacing handle=%d\n",
+			     __FUNCTION__, video->buf->handle));
+			kgem_bo_destroy(&video->sna->kgem, video->buf);
+			video->buf = NULL;
+		}
+	}
+
 	if (video->buf == NULL) {
 		if (video->tiled) {
 			video->buf = kgem_create_2d(&video->sna->kgem,
@@ -122,10 +159,13 @@ sna_video_buffer(struct sna_video *video,
 
 void sna_video_buffer_fini(struct sna_video *video)
 {
+	int n = video->sna->xv.num_buffers - 1;
 	struct kgem_bo *bo;
 
-	bo = video->old_buf[1];
-	video->old_buf[1] = video->old_buf[0];
+	assert(n > 0 && n < ARRAY_SIZE(video->old_buf) + 1);
+	bo = video->old_buf[n - 1];
+	memmove(video->old_buf + 1, video->old_buf,
+		(n - 1) * sizeof(video->old_buf[0]));
 	video->old_buf[0] = video->buf;
 	video->buf = bo;
 }
@@ -297,13 +337,153 @@ sna_video_frame_set_rotation(struct sna_video *video,
 	assert(frame->size);
 }
 
+struct video_rotate {
+	const uint8_t *src;
+	uint8_t *dst;
+	int32_t src_pitch, dst_pitch;
+	int src_x, src_y;
+	int dst_x, dst_y;
+	int width, height;
+	int bpp;
+	int xx, xy, yx, yy;
+};
+
+static void video_rotate_band(void *arg, int y, int height)
+{
+	const struct video_rotate *r = arg;
+
+	rotate_blt(r->src, r->dst, r->bpp, r->src_pitch, r->dst_pitch,
+		   r->src_x + y * r->xy, r->src_y + y * r->yy,
+		   r->dst_x, r->dst_y + y,
+		   r->width, height,
+		   r->xx, r->xy, r->yx, r->yy);
+}
+
+/* Reorient a plane: destination (dst_x + i, dst_y + j) is taken from
+ * source (src_x + i*xx + j*xy, src_y + i*yx + j*yy). Large planes are
+ * split into bands of destination rows across the threads.
+ */
+static void video_rotate(const uint8_t *src, uint8_t *dst, int bpp,
+			 int32_t src_pitch, int32_t dst_pitch,
+			 int src_x, int src_y, int dst_x, int dst_y,
+			 int width, int height,
+			 int xx, int xy, int yx, int yy)
+{
+	struct video_rotate r;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	r.src = src;
+	r.dst = dst;
+	r.src_pitch = src_pitch;
+	r.dst_pitch = dst_pitch;
+	r.src_x = src_x;
+	r.src_y = src_y;
+	r.dst_x = dst_x;
+	r.dst_y = dst_y;
+	r.width = width;
+	r.height = height;
+	r.bpp = bpp;
+	r.xx = xx; r.xy = xy;
+	r.yx = yx; r.yy = yy;
+
+	if (sna_threads_bands(width, height, 32, video_rotate_band, &r))
+		return;
+
+	video_rotate_band(&r, 0, height);
+}
+
+struct video_rotate_packed {
+	const uint8_t *src;
+	uint8_t *dst;
+	int32_t src_pitch, dst_pitch;
+	int width, height;
+	Rotation rotation;
+};
+
+/* Rotate packed 4:2:2 by 90 or 270 degrees. Each destination row is one
+ * source column: the luma is transposed, and the chroma for each pair of
+ * destination pixels comes from a pair of source rows, the even column
+ * reading the first row and the odd column the second. The walk is
+ * blocked so that the source columns we read stay in cache.
+ */
+static void video_rotate_packed_band(void *arg, int y, int height)
+{
+	const struct video_rotate_packed *r = arg;
+	const int32_t pitch = r->src_pitch;
+	const int tile = 32;
+	int y0, p0, row, p;
+
+	for (y0 = y; y0 < y + height; y0 += tile) {
+		int y1 = MIN(y0 + tile, y + height);
+		for (p0 = 0; p0 < r->height; p0 += tile) {
+			int p1 = MIN(p0 + tile, r->height);
+			for (row = y0; row < y1; row++) {
+				int j = r->rotation == RR_Rotate_90 ? r->width - 1 - row : row;
+				const uint8_t *s = r->src + 2*j;
+				const uint8_t *c = r->src + 4*(j >> 1) + 1;
+				uint8_t *d = r->dst + row * r->dst_pitch;
+
+				if (r->rotation == RR_Rotate_90) {
+					for (p = p0; p + 1 < p1; p += 2) {
+						int i = p + (j & 1);
+						d[2*p + 0] = s[p * pitch];
+						d[2*p + 1] = c[i * pitch];
+						d[2*p + 2] = s[(p + 1) * pitch];
+						d[2*p + 3] = c[i * pitch + 2];
+					}
+					if (p < p1) {
+						d[2*p + 0] = s[p * pitch];
+						d[2*p + 1] = c[p * pitch];
+					}
+				} else {
+					for (p = p0; p + 1 < p1; p += 2) {
+						int i = r->height - 2 - p;
+						d[2*p + 0] = s[(i + 1) * pitch];
+						d[2*p + 1] = c[(i + (j & 1)) * pitch];
+						d[2*p + 2] = s[i * pitch];
+						d[2*p + 3] = c[(i + (j & 1)) * pitch + 2];
+					}
+					if (p < p1) {
+						d[2*p + 0] = s[0];
+						d[2*p + 1] = c[0];
+					}
+				}
+			}
+		}
+	}
+}
+
+static void video_rotate_packed(const uint8_t *src, uint8_t *dst,
+				int32_t src_pitch, int32_t dst_pitch,
+				int width, int height, Rotation rotation)
+{
+	struct video_rotate_packed r;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	r.src = src;
+	r.dst = dst;
+	r.src_pitch = src_pitch;
+	r.dst_pitch = dst_pitch;
+	r.width = width;
+	r.height = height;
+	r.rotation = rotation;
+
+	if (sna_threads_bands(2*height, width, 32,
+			      video_rotate_packed_band, &r))
+		return;
+
+	video_rotate_packed_band(&r, 0, width);
+}
+
 static void sna_memcpy_plane(struct sna_video *video,
 			     uint8_t *dst, const uint8_t *src,
 			     const struct sna_video_frame *frame, int sub)
 {
 	int dstPitch = frame->pitch[!sub], srcPitch;
-	const uint8_t *s;
-	int i, j = 0;
 	int x, y, w, h;
 
 	x = frame->image.x1;
@@ -333,31 +513,19 @@ static void sna_memcpy_plane(struct sna_video *video,
 		}
 		break;
 	case RR_Rotate_90:
-		for (i = 0; i < h; i++) {
-			s = src;
-			for (j = 0; j < w; j++)
-				dst[i + ((x + w - j - 1) * dstPitch)] = *s++;
-			src += srcPitch;
-		}
+		video_rotate(src, dst, 8, srcPitch, dstPitch,
+			     w - 1, 0, 0, x, h, w,
+			     0, -1, 1, 0);
 		break;
 	case RR_Rotate_180:
-		for (i = 0; i < h; i++) {
-			s = src;
-			for (j = 0; j < w; j++) {
-				dst[(x + w - j - 1) +
-				    ((h - i - 1) * dstPitch)] = *s++;
-			}
-			src += srcPitch;
-		}
+		video_rotate(src, dst, 8, srcPitch, dstPitch,
+			     w - 1, h - 1, x, 0, w, h,
+			     -1, 0, 0, -1);
 		break;
 	case RR_Rotate_270:
-		for (i = 0; i < h; i++) {
-			s = src;
-			for (j = 0; j < w; j++) {
-				dst[(h - i - 1) + (x + j * dstPitch)] = *s++;
-			}
-			src += srcPitch;
-		}
+		video_rotate(src, dst, 8, srcPitch, dstPitch,
+			     0, h - 1, 0, x, h, w,
+			     0, 1, -1, 0);
 		break;
 	}
 }
@@ -386,6 +554,64 @@ sna_copy_planar_data(struct sna_video *video,
 	sna_memcpy_plane(video, d, src, frame, 1);
 }
 
+/* Split the interleaved chroma of NV12/P010 into separate U and V planes
+ * (and drop P010 down to 8 bits) so that the frame can be sampled using
+ * the same layout and kernels as YV12. Only the unrotated textured path
+ * accepts semi-planar images.
+ */
+static void
+sna_copy_semiplanar_data(struct sna_video *video,
+			 const struct sna_video_frame *frame,
+			 const uint8_t *src, uint8_t *dst)
+{
+	int cpp = frame->id == FOURCC_P010 ? 2 : 1;
+	int srcPitch = ALIGN(frame->width * cpp, 4);
+	const uint8_t *s;
+	uint8_t *d, *u, *v;
+	int x, y, w, h, i;
+
+	assert(video->textured);
+	assert(frame->rotation == RR_Rotate_0);
+
+	x = frame->image.x1;
+	y = frame->image.y1;
+	w = frame->image.x2 - frame->image.x1;
+	h = frame->image.y2 - frame->image.y1;
+
+	s = src + y * srcPitch + x * cpp;
+	src += frame->height * srcPitch;
+
+	d = dst + y * frame->pitch[1] + x;
+	for (i = 0; i < h; i++) {
+		if (cpp == 1) {
+			memcpy(d, s, w);
+		} else {
+			int j;
+			for (j = 0; j < w; j++)
+				d[j] = s[2*j + 1];
+		}
+		s += srcPitch;
+		d += frame->pitch[1];
+	}
+
+	x >>= 1; w >>= 1;
+	y >>= 1; h >>= 1;
+
+	s = src + (frame->image.y1 >> 1) * srcPitch + frame->image.x1 * cpp;
+	u = dst + frame->UBufOffset + y * frame->pitch[0] + x;
+	v = dst + frame->VBufOffset + y * frame->pitch[0] + x;
+	for (i = 0; i < h; i++) {
+		int j;
+		for (j = 0; j < w; j++) {
+			u[j] = s[(2*j + 0) * cpp + cpp - 1];
+			v[j] = s[(2*j + 1) * cpp + cpp - 1];
+		}
+		s += srcPitch;
+		u += frame->pitch[0];
+		v += frame->pitch[0];
+	}
+}
+
 static void
 sna_copy_packed_data(struct sna_video *video,
 		     const struct sna_video_frame *frame,
@@ -393,9 +619,9 @@ sna_copy_packed_data(struct sna_video *video,
 		     uint8_t *dst)
 {
 	int pitch = frame->width << 1;
-	const uint8_t *src, *s;
+	const uint8_t *src;
 	int x, y, w, h;
-	int i, j;
+	int i;
 
 	if (video->textured) {
 		/* XXX support copying cropped extents */
@@ -421,64 +647,15 @@ sna_copy_packed_data(struct sna_video *video,
 		}
 		break;
 	case RR_Rotate_90:
-		h <<= 1;
-		for (i = 0; i < h; i += 2) {
-			s = src;
-			for (j = 0; j < w; j++) {
-				/* Copy Y */
-				dst[(i + 0) + ((w - j - 1) * frame->pitch[0])] = *s;
-				s += 2;
-			}
-			src += pitch;
-		}
-		h >>= 1;
-		src = buf + (y * pitch) + (x << 1);
-		for (i = 0; i < h; i += 2) {
-			for (j = 0; j < w; j += 2) {
-				/* Copy U */
-				dst[((i * 2) + 1) + ((w - j - 1) * frame->pitch[0])] = src[(j * 2) + 1 + (i * pitch)];
-				dst[((i * 2) + 1) + ((w - j - 2) * frame->pitch[0])] = src[(j * 2) + 1 + ((i + 1) * pitch)];
-				/* Copy V */ dst[((i * 2) + 3) + ((w - j - 1) * frame->pitch[0])] = src[(j * 2) + 3 + (i * pitch)];
-				dst[((i * 2) + 3) + ((w - j - 2) * frame->pitch[0])] = src[(j * 2) + 3 + ((i + 1) * pitch)];
-			}
-		}
+	case RR_Rotate_270:
+		video_rotate_packed(src, dst, pitch, frame->pitch[0],
+				    w, h, frame->rotation);
 		break;
 	case RR_Rotate_180:
-		w <<= 1;
-		for (i = 0; i < h; i++) {
-			s = src;
-			for (j = 0; j < w; j += 4) {
-				dst[(w - j - 4) + ((h - i - 1) * frame->pitch[0])] = *s++;
-				dst[(w - j - 3) + ((h - i - 1) * frame->pitch[0])] = *s++;
-				dst[(w - j - 2) + ((h - i - 1) * frame->pitch[0])] = *s++;
-				dst[(w - j - 1) + ((h - i - 1) * frame->pitch[0])] = *s++;
-			}
-			src += pitch;
-		}
-		break;
-	case RR_Rotate_270:
-		h <<= 1;
-		for (i = 0; i < h; i += 2) {
-			s = src;
-			for (j = 0; j < w; j++) {
-				/* Copy Y */
-				dst[(h - i - 2) + (j * frame->pitch[0])] = *s;
-				s += 2;
-			}
-			src += pitch;
-		}
-		h >>= 1;
-		src = buf + (y * pitch) + (x << 1);
-		for (i = 0; i < h; i += 2) {
-			for (j = 0; j < w; j += 2) {
-				/* Copy U */
-				dst[(((h - i) * 2) - 3) + (j * frame->pitch[0])] = src[(j * 2) + 1 + (i * pitch)];
-				dst[(((h - i) * 2) - 3) + ((j + 1) * frame->pitch[0])] = src[(j * 2) + 1 + ((i + 1) * pitch)];
-				/* Copy V */
-				dst[(((h - i) * 2) - 1) + (j * frame->pitch[0])] = src[(j * 2) + 3 + (i * pitch)];
-				dst[(((h - i) * 2) - 1) + ((j + 1) * frame->pitch[0])] = src[(j * 2) + 3 + ((i + 1) * pitch)];
-			}
-		}
+		/* reverse the order of the macropixels */
+		video_rotate(src, dst, 32, pitch, frame->pitch[0],
+			     (w >> 1) - 1, h - 1, 0, 0, w >> 1, h,
+			     -1, 0, 0, -1);
 		break;
 	}
 }
@@ -503,7 +680,8 @@ sna_video_copy_data(struct sna_video *video,
 	assert(frame->size);
 
 	/* In the common case, we can simply the upload in a single pwrite */
-	if (frame->rotation == RR_Rotate_0 && !video->tiled) {
+	if (frame->rotation == RR_Rotate_0 && !video->tiled &&
+	    !is_semiplanar_fourcc(frame->id)) {
 		DBG(("%s: unrotated, untiled fast paths: is-planar?=%d\n",
 		     __FUNCTION__, is_planar_fourcc(frame->id)));
 		if (is_planar_fourcc(frame->id)) {
@@ -583,7 +761,9 @@ use_gtt: /* copy data, must use GTT so that we keep the overlay uncached */
 			return false;
 	}
 
-	if (is_planar_fourcc(frame->id))
+	if (is_semiplanar_fourcc(frame->id))
+		sna_copy_semiplanar_data(video, frame, buf, dst);
+	else if (is_planar_fourcc(frame->id))
 		sna_copy_planar_data(video, frame, buf, dst);
 	else
 		sna_copy_packed_data(video, frame, buf, dst);
@@ -591,6 +771,58 @@ use_gtt: /* copy data, must use GTT so that we keep the overlay uncached */
 	return true;
 }
 
+/* Sample the client's image in place (typically an MIT-SHM segment)
+ * rather than copying it into a fresh buffer. The caller must wait for
+ * the GPU to finish reading before returning control to the client.
+ */
+bool
+sna_video_map_data(struct sna_video *video,
+		   struct sna_video_frame *frame,
+		   const uint8_t *buf)
+{
+	struct kgem *kgem = &video->sna->kgem;
+
+	if (!USE_USERPTR_VIDEO || !kgem->has_userptr)
+		return false;
+
+	if (!video->textured || frame->rotation != RR_Rotate_0)
+		return false;
+
+	if ((uintptr_t)buf & 3)
+		return false;
+
+	/* The frame must match the layout from sna_video_textured_query() */
+	if (is_semiplanar_fourcc(frame->id)) {
+		return false;
+	} else if (is_planar_fourcc(frame->id)) {
+		if (frame->pitch[1] != ALIGN(frame->width, 4) ||
+		    frame->pitch[0] != ALIGN(frame->width >> 1, 4))
+			return false;
+	} else {
+		if (frame->pitch[0] != 2U*frame->width)
+			return false;
+	}
+
+	DBG(("%s: mapping client data %p, size=%d\n",
+	     __FUNCTION__, buf, frame->size));
+
+	assert(frame->bo == NULL);
+	frame->bo = kgem_create_map(kgem, (void *)buf, frame->size, true);
+	if (frame->bo == NULL)
+		return false;
+
+	kgem_bo_mark_unreusable(frame->bo);
+
+	if (is_planar_fourcc(frame->id) && frame->id != FOURCC_I420) {
+		uint32_t tmp;
+		tmp = frame->VBufOffset;
+		frame->VBufOffset = frame->UBufOffset;
+		frame->UBufOffset = tmp;
+	}
+
+	return true;
+}
+
 void sna_video_fill_colorkey(struct sna_video *video,
 			     const RegionRec *clip)
 {
@@ -748,9 +980,21 @@ void sna_video_init(struct sna *sna, ScreenPtr screen)
 {
 	XvScreenPtr xv;
 
+	list_init(&sna->xv.pending);
+
 	if (noXvExtension)
 		return;
 
+	if (!xf86GetOptValInteger(sna->Options, OPTION_VIDEO_BUFFERS,
+				  &sna->xv.num_buffers))
+		sna->xv.num_buffers = 3;
+	if (sna->xv.num_buffers < 3)
+		sna->xv.num_buffers = 3;
+	if (sna->xv.num_buffers > SNA_VIDEO_MAX_BUFFERS)
+		sna->xv.num_buffers = SNA_VIDEO_MAX_BUFFERS;
+
+	sna->xv.batch = xf86ReturnOptValBool(sna->Options, OPTION_VIDEO_BATCH, FALSE);
+
 	if (xf86LoaderCheckSymbol("xf86XVListGenericAdaptors")) {
 		XF86VideoAdaptorPtr *adaptors = NULL;
 		int num_adaptors = xf86XVListGenericAdaptors(sna->scrn, &adaptors);
@@ -807,7 +1051,24 @@ void sna_video_close(struct sna *sna)
 {
 	int i;
 
+	sna_video_flush(sna);
+
 	for (i = 0; i < sna->xv.num_adaptors; i++) {
+		struct sna_video *video = sna->xv.adaptors[i].pPorts->devPriv.ptr;
+		int j;
+
+		for (j = 0; j < sna->xv.adaptors[i].nPorts; j++) {
+			if (video[j].stats.frames == 0)
+				continue;
+
+			xf86DrvMsgVerb(sna->scrn->scrnIndex, X_INFO, 3,
+				       "%s port %d: %lu frames, %lu late, %lu dropped\n",
+				       sna->xv.adaptors[i].name, j,
+				       video[j].stats.frames,
+				       video[j].stats.late,
+				       video[j].stats.dropped);
+		}
+
 		free(sna->xv.adaptors[i].pPorts->devPriv.ptr);
 		free(sna->xv.adaptors[i].pPorts);
 		free(sna->xv.adaptors[i].pEncodings);
@@ -39,6 +39,13 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define FOURCC_RGB565 ((16 << 24) + ('B' << 16) + ('G' << 8) + 'R')
 #define FOURCC_RGB888 ((24 << 24) + ('B' << 16) + ('G' << 8) + 'R')
 
+#ifndef FOURCC_NV12
+#define FOURCC_NV12 (('2' << 24) + ('1' << 16) + ('V' << 8) + 'N')
+#endif
+#ifndef FOURCC_P010
+#define FOURCC_P010 (('0' << 24) + ('1' << 16) + ('0' << 8) + 'P')
+#endif
+
 /*
  * Below, a dummy picture type that is used in XvPutImage
  * only to do an overlay update.
@@ -69,6 +76,49 @@ THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 	XvTopToBottom \
 }
 
+/*
+ * Semi-planar formats: a full resolution luma plane followed by a single
+ * plane of interleaved Cb/Cr samples subsampled 2x2. P010 stores each
+ * sample in the upper 10 bits of a little-endian 16-bit word.
+ */
+#ifndef XVIMAGE_NV12
+#define XVIMAGE_NV12 { \
+	FOURCC_NV12, XvYUV, LSBFirst, \
+	{'N', 'V', '1', '2', 0x00, 0x00, 0x00, 0x10, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71}, \
+	12, XvPlanar, 2, 0, 0, 0, 0, 8, 8, 8, 1, 2, 2, 1, 2, 2, \
+	{'Y', 'U', 'V', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, \
+	XvTopToBottom \
+}
+#endif
+
+#ifndef XVIMAGE_P010
+#define XVIMAGE_P010 { \
+	FOURCC_P010, XvYUV, LSBFirst, \
+	{'P', '0', '1', '0', 0x00, 0x00, 0x00, 0x10, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71}, \
+	24, XvPlanar, 2, 0, 0, 0, 0, 10, 10, 10, 1, 2, 2, 1, 2, 2, \
+	{'Y', 'U', 'V', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, \
+	XvTopToBottom \
+}
+#endif
+
+struct sna_video_frame {
+	struct kgem_bo *bo;
+	uint32_t id;
+	uint32_t size;
+	uint32_t UBufOffset;
+	uint32_t VBufOffset;
+	Rotation rotation;
+
+	uint16_t width, height;
+	uint16_t pitch[2];
+
+	/* extents */
+	BoxRec image;
+	BoxRec src;
+};
+
+#define SNA_VIDEO_MAX_BUFFERS 8
+
 struct sna_video {
 	struct sna *sna;
 
@@ -90,11 +140,17 @@ struct sna_video {
 	unsigned color_key_changed;
 	bool has_color_key;
 
-	/** YUV data buffers */
-	struct kgem_bo *old_buf[2];
+	/** YUV data buffers, old_buf[0] being the frame last shown */
+	struct kgem_bo *old_buf[SNA_VIDEO_MAX_BUFFERS - 1];
 	struct kgem_bo *buf;
 	int width, height, format;
 
+	struct {
+		unsigned long frames;
+		unsigned long late; /* next buffer still busy */
+		unsigned long dropped;
+	} stats;
+
 	int alignment;
 	bool tiled;
 	bool textured;
@@ -103,26 +159,19 @@ struct sna_video {
 	struct kgem_bo *bo[4];
 	RegionRec clip;
 
+	/** Textured frame waiting to be composited by sna_video_flush() */
+	struct {
+		struct list link;
+		struct sna_video_frame frame;
+		RegionRec clip;
+		PixmapPtr pixmap;
+		xf86CrtcPtr crtc;
+	} pending;
+
 	int SyncToVblank;	/* -1: auto, 0: off, 1: on */
 	int AlwaysOnTop;
 };
 
-struct sna_video_frame {
-	struct kgem_bo *bo;
-	uint32_t id;
-	uint32_t size;
-	uint32_t UBufOffset;
-	uint32_t VBufOffset;
-	Rotation rotation;
-
-	uint16_t width, height;
-	uint16_t pitch[2];
-
-	/* extents */
-	BoxRec image;
-	BoxRec src;
-};
-
 static inline XvScreenPtr to_xv(ScreenPtr screen)
 {
 	return dixLookupPrivate(&screen->devPrivates, XvGetScreenKey());
@@ -154,12 +203,28 @@ static inline int xvmc_passthrough(int id)
 	}
 }
 
+static inline int is_semiplanar_fourcc(int id)
+{
+	switch (id) {
+	case FOURCC_NV12:
+	case FOURCC_P010:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Semi-planar frames are split into separate U and V planes on upload,
+ * so from the point of view of the sampler they are planar as well.
+ */
 static inline int is_planar_fourcc(int id)
 {
 	switch (id) {
 	case FOURCC_YV12:
 	case FOURCC_I420:
 	case FOURCC_XVMC:
+	case FOURCC_NV12:
+	case FOURCC_P010:
 		return 1;
 	default:
 		return 0;
@@ -195,6 +260,10 @@ bool
 sna_video_copy_data(struct sna_video *video,
 		    struct sna_video_frame *frame,
 		    const uint8_t *buf);
+bool
+sna_video_map_data(struct sna_video *video,
+		   struct sna_video_frame *frame,
+		   const uint8_t *buf);
 void
 sna_video_fill_colorkey(struct sna_video *video,
 			const RegionRec *clip);
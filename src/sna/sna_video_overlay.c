@@ -542,6 +542,7 @@ sna_video_overlay_put_image(ddPutImage_ARGS)
 
 		if (!sna_video_copy_data(video, &frame, buf)) {
 			DBG(("%s: failed to copy video data\n", __FUNCTION__));
+			video->stats.dropped++;
 			return BadAlloc;
 		}
 	}
@@ -553,6 +554,7 @@ sna_video_overlay_put_image(ddPutImage_ARGS)
 		sna_window_set_port((WindowPtr)draw, port);
 	} else {
 		DBG(("%s: failed to show video frame\n", __FUNCTION__));
+		video->stats.dropped++;
 		ret = BadAlloc;
 	}
 
@@ -517,6 +517,7 @@ off:
 
 			if (!sna_video_copy_data(video, &frame, buf)) {
 				DBG(("%s: failed to copy video data\n", __FUNCTION__));
+				video->stats.dropped++;
 				ret = BadAlloc;
 				goto err;
 			}
@@ -579,6 +580,7 @@ off:
 		ret = Success;
 		if (!sna_video_sprite_show(sna, video, &frame, crtc, &dst)) {
 			DBG(("%s: failed to show video frame\n", __FUNCTION__));
+			video->stats.dropped++;
 			ret = BadAlloc;
 		}
 
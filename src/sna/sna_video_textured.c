@@ -58,15 +58,170 @@ static const XvImageRec gen3_Images[] = {
 	XVIMAGE_YV12,
 	XVIMAGE_I420,
 	XVIMAGE_UYVY,
+	XVIMAGE_NV12,
+	XVIMAGE_P010,
 	XVMC_YUV,
 };
 
+/* With "VideoBatch" enabled, frames are queued here by PutImage and
+ * composited together before we sleep in the block handler (or earlier
+ * should anything else touch the target pixmap). Walls of many streams
+ * sharing one destination then share a single scanline wait and a single
+ * submission, and the render backends only emit state as it changes
+ * between the frames.
+ */
+static bool sna_video_textured_migrate(struct sna_video *video)
+{
+	RegionPtr clip = &video->pending.clip;
+	unsigned flags;
+
+	flags = MOVE_WRITE | __MOVE_FORCE;
+	if (clip->data)
+		flags |= MOVE_READ;
+
+	return sna_pixmap_move_area_to_gpu(video->pending.pixmap,
+					   &clip->extents, flags) != NULL;
+}
+
+static void sna_video_textured_render(struct sna *sna,
+				      struct sna_video *video)
+{
+	PixmapPtr pixmap = video->pending.pixmap;
+	RegionPtr clip = &video->pending.clip;
+
+	if (!sna->render.video(sna, video, &video->pending.frame, clip, pixmap)) {
+		DBG(("%s: failed to render video\n", __FUNCTION__));
+		video->stats.dropped++;
+	} else
+		DamageDamageRegion(&pixmap->drawable, clip);
+}
+
+static void sna_video_textured_release(struct sna *sna,
+				       struct sna_video *video)
+{
+	PixmapPtr pixmap = video->pending.pixmap;
+
+	kgem_bo_destroy(&sna->kgem, video->pending.frame.bo);
+	RegionUninit(&video->pending.clip);
+	pixmap->drawable.pScreen->DestroyPixmap(pixmap);
+	video->pending.pixmap = NULL;
+}
+
+void sna_video_flush(struct sna *sna)
+{
+	struct sna_video *video, *v;
+	struct list pending;
+	bool flush = false;
+
+	if (list_is_empty(&sna->xv.pending))
+		return;
+
+	DBG(("%s\n", __FUNCTION__));
+
+	/* Detach first so that migrating the targets does not recurse */
+	list_init(&pending);
+	list_splice(&sna->xv.pending, &pending);
+	list_init(&sna->xv.pending);
+	list_for_each_entry(video, &pending, pending.link)
+		sna_pixmap(video->pending.pixmap)->deferred_video = 0;
+
+	/* Migrating a target may submit the batch or switch rings, so do
+	 * all of that before emitting any scanline wait; each wait then
+	 * lands in the same batch as the frames it guards.
+	 */
+	list_for_each_entry_safe(video, v, &pending, pending.link) {
+		if (sna_video_textured_migrate(video))
+			continue;
+
+		DBG(("%s: failed to migrate target pixmap=%ld\n",
+		     __FUNCTION__, video->pending.pixmap->drawable.serialNumber));
+		video->stats.dropped++;
+		list_del(&video->pending.link);
+		sna_video_textured_release(sna, video);
+	}
+
+	while (!list_is_empty(&pending)) {
+		PixmapPtr pixmap;
+		xf86CrtcPtr crtc;
+
+		video = list_first_entry(&pending, struct sna_video, pending.link);
+		list_del(&video->pending.link);
+
+		pixmap = video->pending.pixmap;
+		crtc = video->pending.crtc;
+		if (crtc && sna_pixmap_is_scanout(sna, pixmap)) {
+			BoxRec extents = video->pending.clip.extents;
+
+			/* One wait covering every frame bound for this crtc */
+			list_for_each_entry(v, &pending, pending.link) {
+				if (v->pending.pixmap != pixmap ||
+				    v->pending.crtc != crtc)
+					continue;
+
+				if (v->pending.clip.extents.x1 < extents.x1)
+					extents.x1 = v->pending.clip.extents.x1;
+				if (v->pending.clip.extents.y1 < extents.y1)
+					extents.y1 = v->pending.clip.extents.y1;
+				if (v->pending.clip.extents.x2 > extents.x2)
+					extents.x2 = v->pending.clip.extents.x2;
+				if (v->pending.clip.extents.y2 > extents.y2)
+					extents.y2 = v->pending.clip.extents.y2;
+				v->pending.crtc = NULL;
+			}
+
+			DBG(("%s: waiting for scanline on pipe=%d, (%d, %d), (%d, %d)\n",
+			     __FUNCTION__, sna_crtc_pipe(crtc),
+			     extents.x1, extents.y1, extents.x2, extents.y2));
+
+			kgem_set_mode(&sna->kgem, KGEM_RENDER, sna_pixmap(pixmap)->gpu_bo);
+			flush |= sna_wait_for_scanline(sna, pixmap, crtc, &extents);
+		}
+
+		sna_video_textured_render(sna, video);
+		sna_video_textured_release(sna, video);
+	}
+
+	/* Push the frames to the GPU as soon as possible so
+	 * we can hit the next vsync.
+	 */
+	if (flush)
+		kgem_submit(&sna->kgem);
+}
+
+static void sna_video_textured_defer(struct sna *sna,
+				     struct sna_video *video,
+				     struct sna_video_frame *frame,
+				     RegionPtr clip,
+				     PixmapPtr pixmap,
+				     xf86CrtcPtr crtc)
+{
+	DBG(("%s: pixmap=%ld, crtc=%d\n", __FUNCTION__,
+	     pixmap->drawable.serialNumber, crtc ? sna_crtc_pipe(crtc) : -1));
+
+	/* Keep the frames from one port in order */
+	if (video->pending.pixmap)
+		sna_video_flush(sna);
+	assert(video->pending.pixmap == NULL);
+
+	video->pending.frame = *frame;
+	video->pending.clip = *clip;
+	video->pending.crtc = crtc;
+	video->pending.pixmap = pixmap;
+	pixmap->refcnt++;
+
+	sna_pixmap(pixmap)->deferred_video++;
+	list_add_tail(&video->pending.link, &sna->xv.pending);
+}
+
 static int sna_video_textured_stop(ddStopVideo_ARGS)
 {
 	struct sna_video *video = port->devPriv.ptr;
 
 	DBG(("%s()\n", __FUNCTION__));
 
+	if (video->pending.pixmap)
+		sna_video_flush(video->sna);
+
 	RegionUninit(&video->clip);
 	sna_video_free_buffers(video);
 
@@ -155,7 +310,7 @@ sna_video_textured_put_image(ddPutImage_ARGS)
 	RegionRec clip;
 	xf86CrtcPtr crtc;
 	int16_t dx, dy;
-	bool flush = false;
+	bool flush = false, vsync, mapped = false, defer;
 	bool ret;
 
 	if (wedged(sna))
@@ -190,18 +345,26 @@ sna_video_textured_put_image(ddPutImage_ARGS)
 	if (get_drawable_deltas(draw, pixmap, &dx, &dy))
 		RegionTranslate(&clip, dx, dy);
 
-	flags = MOVE_WRITE | __MOVE_FORCE;
-	if (clip.data)
-		flags |= MOVE_READ;
+	/* Migration of the target is left to sna_video_flush() */
+	defer = sna->xv.batch && !sync && sna_pixmap(pixmap);
+	if (!defer) {
+		flags = MOVE_WRITE | __MOVE_FORCE;
+		if (clip.data)
+			flags |= MOVE_READ;
 
-	if (!sna_pixmap_move_area_to_gpu(pixmap, &clip.extents, flags)) {
-		DBG(("%s: attempting to render to a non-GPU pixmap\n",
-		     __FUNCTION__));
-		return BadAlloc;
+		if (!sna_pixmap_move_area_to_gpu(pixmap, &clip.extents, flags)) {
+			DBG(("%s: attempting to render to a non-GPU pixmap\n",
+			     __FUNCTION__));
+			return BadAlloc;
+		}
 	}
 
 	sna_video_frame_set_rotation(video, &frame, RR_Rotate_0);
 
+	/* Waiting upon the scanline would stall the sync on a mapped frame */
+	vsync = crtc && video->SyncToVblank != 0 &&
+		sna_pixmap_is_scanout(sna, pixmap);
+
 	if (xvmc_passthrough(format->id)) {
 		DBG(("%s: using passthough, name=%d\n",
 		     __FUNCTION__, *(uint32_t *)buf));
@@ -223,6 +386,10 @@ sna_video_textured_put_image(ddPutImage_ARGS)
 		frame.image.y1 = 0;
 		frame.image.x2 = frame.width;
 		frame.image.y2 = frame.height;
+	} else if (!vsync && !defer && sna_video_map_data(video, &frame, buf)) {
+		DBG(("%s: sampling directly from client memory\n",
+		     __FUNCTION__));
+		mapped = true;
 	} else {
 		if (!sna_video_copy_data(video, &frame, buf)) {
 			DBG(("%s: failed to copy frame\n", __FUNCTION__));
@@ -231,8 +398,13 @@ sna_video_textured_put_image(ddPutImage_ARGS)
 		}
 	}
 
-	if (crtc && video->SyncToVblank != 0 &&
-	    sna_pixmap_is_scanout(sna, pixmap)) {
+	if (defer) {
+		sna_video_textured_defer(sna, video, &frame, &clip, pixmap,
+					 vsync ? crtc : NULL);
+		return Success;
+	}
+
+	if (vsync) {
 		kgem_set_mode(&sna->kgem, KGEM_RENDER, sna_pixmap(pixmap)->gpu_bo);
 		flush = sna_wait_for_scanline(sna, pixmap, crtc,
 					      &clip.extents);
@@ -245,6 +417,9 @@ sna_video_textured_put_image(ddPutImage_ARGS)
 	} else
 		DamageDamageRegion(&pixmap->drawable, &clip);
 
+	/* The client is free to reuse its buffer as soon as we reply */
+	if (mapped)
+		kgem_bo_sync__cpu(&sna->kgem, frame.bo);
 	kgem_bo_destroy(&sna->kgem, frame.bo);
 
 	/* Push the frame to the GPU as soon as possible so
@@ -298,6 +473,22 @@ sna_video_textured_query(ddQueryImageAttributes_ARGS)
 			offsets[2] = size;
 		size += tmp;
 		break;
+	case FOURCC_NV12:
+	case FOURCC_P010:
+		/* The interleaved chroma plane shares the luma pitch */
+		*h = (*h + 1) & ~1;
+		size = *w;
+		if (format->id == FOURCC_P010)
+			size <<= 1;
+		size = (size + 3) & ~3;
+		if (pitches)
+			pitches[0] = pitches[1] = size;
+		tmp = size * (*h >> 1);
+		size *= *h;
+		if (offsets)
+			offsets[1] = size;
+		size += tmp;
+		break;
 	case FOURCC_UYVY:
 	case FOURCC_YUY2:
 	default: